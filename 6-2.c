@@ -9,10 +9,19 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <poll.h>
+#include "file_cache.h"
+#include "fd_cache.h"
 
 #define BUFFER_SIZE 1024
-static const char* status_line[2] = {"200 OK", "500 Internal server error"};
+
+/* 文件只读地映射一次，和预先序列化的头部一起按文件名缓存，随文件的修改时间更新；出错的应答是固定的 */
+static file_cache files;
+/* 打开的文件和它的属性也缓存起来，文件变化由inotify通知，热点文件不再需要stat和open */
+static fd_cache fds;
+static const cached_response error_reply = make_response("500 Internal server error", "text/html; charset=UTF-8", "");
 
 int main(int argc, char const *argv[])
 {
@@ -41,41 +50,58 @@ int main(int argc, char const *argv[])
 	ret = listen(sock, 5);
 	assert(ret != -1);
 
-	struct sockaddr_in client;
-	socklen_t client_addrlength = sizeof(client);
-	int connfd = accept(sock, (struct sockaddr*)&client, &client_addrlength);
-	if (connfd < 0)
-	{
-		printf("errno is : %d\n", errno);
-	}
-	else
+	/* 同时等待新连接和文件变化的通知，只在inotify的fd可读时才去读事件；inotify不可用时fd为-1，poll会忽略它 */
+	struct pollfd pfds[2];
+	pfds[0].fd = sock;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = fds.notify_fd();
+	pfds[1].events = POLLIN;
+
+	while (1)
 	{
-		/* HTTP应答状态、头部、空行的缓存区 */
-		char header_buf[BUFFER_SIZE];
-		memset(header_buf, '\0', BUFFER_SIZE);
-		/* 目标文件缓存 */
-		char* file_buf;
-		/* 文件属性 */
-		struct stat file_stat;
+		ret = poll(pfds, 2, -1);
+		if (ret < 0)
+		{
+			printf("errno is : %d\n", errno);
+			if (errno == EINTR) continue;
+			break;
+		}
+		/* 先处理文件变化的通知，再从缓存中取打开的文件和它的属性 */
+		if (pfds[1].revents & POLLIN) fds.process_events();
+		if (!(pfds[0].revents & POLLIN)) continue;
+
+		struct sockaddr_in client;
+		socklen_t client_addrlength = sizeof(client);
+		int connfd = accept(sock, (struct sockaddr*)&client, &client_addrlength);
+		if (connfd < 0)
+		{
+			printf("errno is : %d\n", errno);
+			if (errno == EINTR) continue;
+			break;
+		}
+		/* 读掉请求（不解析）；关闭时接收缓冲区中还有数据会发出RST，客户端可能收不全应答 */
+		char request[BUFFER_SIZE];
+		recv(connfd, request, sizeof(request), 0);
+		/* 目标文件在缓存中的映射 */
+		file_entry* file = NULL;
+		fd_entry* opened = fds.acquire(file_name);
 		/* 文件是否有效 */
 		bool valid = true;
-		int len = 0;
-		if (stat(file_name, &file_stat) < 0) //文件不存在
+		if (!opened) //文件不存在
 		{
 			valid = false;
 		}
 		else 
 		{
+			const struct stat& file_stat = opened->st;
 			if (S_ISDIR(file_stat.st_mode)) // 目录
 			{
 				valid = false;
 			}
 			else if (file_stat.st_mode & S_IROTH) //当前用户拥有文件的权限
 			{
-				int fd = open(file_name, O_RDONLY);
-				file_buf = new char[file_stat.st_size + 1];
-				memset(file_buf, '\0', file_stat.st_size + 1);
-				if (read(fd, file_buf, file_stat.st_size) < 0)
+				file = files.acquire(file_name, file_stat, opened->fd);
+				if (!file)
 				{
 					valid = false;
 				}
@@ -85,37 +111,25 @@ int main(int argc, char const *argv[])
 				valid = false;
 			}
 		}
+		struct iovec iv[2];
+		int count;
 		if (valid)
 		{
-			/* HTTP应答、头部、空行加入缓存中 */
-			ret = snprintf(header_buf, BUFFER_SIZE - 1,
-				"%s %s\r\n", "HTTP/1.1", status_line[0]);
-			len += ret;
-			ret = snprintf(header_buf + len, BUFFER_SIZE-1-len,
-				"Content-Length: %d\r\n", file_stat.st_size);
-			len +=ret;
-			ret = snprintf(header_buf + len, BUFFER_SIZE-1-len,
-				"%s", "\r\n");
-			struct iovec iv[2];
-			iv[0].iov_base = header_buf;
-			iv[0].iov_len = strlen(header_buf);
-			iv[1].iov_base = file_buf;
-			iv[1].iov_len = file_stat.st_size;
-			ret = writev(connfd, iv, 2);
+			/* 头部和文件内容都来自缓存，文件没有变化时既不读文件也不分配内存 */
+			count = file->fill_iov(iv);
 		}
 		else
 		{
-			ret = snprintf(header_buf, BUFFER_SIZE-1,
-				"%s %s\r\n", status_line[1]);
-			len += ret;
-			ret = snprintf(header_buf + len, BUFFER_SIZE-1-len,
-				"%s", "\r\n");
-			send(connfd, header_buf, strlen(header_buf), 0);
+			count = error_reply.fill_iov(iv);
 		}
+		if (opened) fds.release(opened);
+		ret = writev(connfd, iv, count);
 		close(connfd);
-		delete [] file_buf;
+		if (file) files.release(file);
 	}
 
 	close(sock);
+	files.dump(stdout, "files");
+	fds.dump(stdout, "fds");
 	return 0;
 }
\ No newline at end of file
@@ -8,209 +8,156 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
-
-#define BUFFER_SIZE 4096
-
-/* 主机状态 */
-enum CHECK_STATE
-{
-	CHECK_STATE_REQUESTLINE = 0, // 正在分析请求行
-	CHECK_STATE_HEADER           // 正在分析头部字段
-};
-
-/* 状态机的三种可能状态 */
-enum LINE_STATUS
+#include <sys/uio.h>
+#include "chain_buffer.h"
+#include "http_parser.h"
+#include "response_cache.h"
+
+#define BUFFER_SIZE 65536 /* 接收缓冲区的上限，即一个请求的最大长度 */
+#define MAX_PIPELINE 64 /* 一次writev最多合并的应答个数 */
+
+/* 简化设计，仅应答成功或者失败；带上Content-Length，客户端才能在持久连接上区分相邻的应答
+   应答在启动时序列化一次，发送时只需填写iovec */
+static const cached_response ok_reply = make_response("200 OK", "text/html; charset=UTF-8", "I get a correct result\n");
+static const cached_response bad_reply = make_response("400 Bad Request", "text/html; charset=UTF-8",
+	"Whoops, Sometion wrong\n", "Connection: close\r\n");
+
+/* 把iv中的数据全部写出，返回是否成功；阻塞的socket上writev也可能只写出一部分 */
+bool writev_all(int fd, struct iovec* iv, int count)
 {
-	LINE_OK = 0, // 完整行
-	LINE_BAD,    // 行出错
-	LINE_OPEN    // 尚不完整
-};
-
-/* HTTP请求结果 */
-enum HTTP_CODE
-{
-	NO_REQUEST,        // 请求不完整，需要继续读取
-	GET_REQUEST,       // 获得了一个完整的请求结果
-	BAD_REQUEST,       // 请求语法错误
-	FORBIDDEN_REQUEST, // 客户权限不够
-	INTERNAL_ERROR,    // 服务器内部错误
-	CLOSED_CONNECTION  // 客户端已经关闭链接
-};
-
-/* 简化设计，仅应答成功或者失败 */
-static const char* szret[] = {
-	"HTTP/1.1 200 OK\rContent-Type: text/html; charset=UTF-8\r\nI get a correct result\n",
-	"HTTP/1.1 200 OK\rContent-Type: text/html; charset=UTF-8\r\nWhoops, Sometion wrong\n"
-};
-// static const char* szret[] = {"I get a correct result\n", "Hoops,Sometion wrong\n"};
-
-LINE_STATUS parse_line(char* buffer, int &checked_index, int &read_index)
-{
-	char temp;
-	/* checked_index指向目前buffer正在分析的字符
-	*  read_index指向buffer中客户端数据尾部的下一个字节
-	*/
-	for (; checked_index < read_index; ++checked_index)
+	while (count > 0)
 	{
-		temp = buffer[ checked_index ];
-		if (temp == '\r') // 可能读到一个完整的行
+		ssize_t n = writev(fd, iv, count);
+		if (n < 0)
 		{
-			if ((checked_index + 1) == read_index) // \r是最后一个被读入的数据，那么需要继续读取才能进一步分析
-			{
-				return LINE_OPEN;
-			}
-			else if (buffer[checked_index + 1] == '\n') // 说明读到一个完整的行
-			{
-				buffer[checked_index++] = '\0';
-				buffer[checked_index++] = '\0';
-				return LINE_OK;
-			}
-			return LINE_BAD; // 请求语法错误
+			if (errno == EINTR) continue;
+			return false;
 		}
-		else if (temp == '\n') // 也可能是完整的行
+		while (count > 0 && (size_t)n >= iv->iov_len)
 		{
-			if ((checked_index > 1) && buffer[checked_index - 1] == '\r')
-			{
-				buffer[checked_index++] = '\0';
-				buffer[checked_index++] = '\0';
-				return LINE_OK;
-			}
-			return LINE_BAD; // \r\n 应该成对出现
+			n -= iv->iov_len;
+			++iv;
+			--count;
+		}
+		if (count > 0)
+		{
+			iv->iov_base = (char*)iv->iov_base + n;
+			iv->iov_len -= n;
 		}
 	}
-	/* 如果内容分析完毕也没有遇到\r字符，表示还需要读取才能进一步分析 */
-	return LINE_OPEN;
+	return true;
 }
 
-
-/**
- * 解析 GET /search HTTP/1.1 的请求行
- * @param  temp       请求数据存放缓冲区
- * @param  checkstats 解析状态
- * @return            解析结果
- */
-HTTP_CODE parse_requestline(char* temp, CHECK_STATE &checkstats)
+/* 示例的消息体处理函数：只统计长度（由解析器累加到body_received），数据直接丢弃 */
+void drop_body(http_request*, const char*, int)
 {
-	/* 找到temp第一个空白符或者\t所在的位置（地址） */
-	char* url = strpbrk(temp, " \t"); // 请求行没有空白或'\t'，请求一定有问题
-	if (!url)
-	{
-		return BAD_REQUEST;
-	}
-	*url++ = '\0';
-
-	char* method = temp;
-	/* 比较s1和s2大小，忽略大小写 */
-	if (strcasecmp(method, "GET") == 0) // 暂时近支持GET方法
-	{
-		printf("The request method is GET\n");
-	}
-	else
-	{
-		return BAD_REQUEST;
-	}
-
-	/* strspn返回str1中第一个不在str2中的字符位置（偏移） */
-	url += strspn(url, " \t");
-	char* version = strpbrk(url, " \t");
-	if (!version)
-	{
-		return BAD_REQUEST;
-	}
-	*version++ = '\0';
-	version += strspn(version, " \t");
-	/* 仅支持HTTP1.1 */
-	if (strcasecmp(version, "HTTP/1.1") != 0)
-	{
-		return BAD_REQUEST;
-	}
-	/* 比较s1和s2前n个字符的大小，忽略大小写 */
-	if (strncasecmp(url, "http://", 7) == 0)
-	{
-		url += 7;
-		/* strchr寻找s1中第一次出现ch的位置（地址） */
-		url = strchr(url, '/');
-	}
-
-	if (!url || url[0] != '/')
-	{
-		return BAD_REQUEST;
-	}
-	printf("The request URL is: %s\n", url);
-	checkstats = CHECK_STATE_HEADER;
-	return NO_REQUEST;
 }
 
 /**
- * 分析头部字段比如下面之类的
- * Accept: 、Referer: 、Accept-Language: 、Accept-Encoding: 、User-Agent: 、 Host: 
+ * 在一个持久连接上处理请求，直到客户端关闭、请求出错或者不再保持连接
+ * 一次读到的多个流水线请求连续解析，应答攒在iovec中，最后用一次writev发出
+ * 每个请求处理完后在原地重置解析状态，还没分析的数据留在缓冲区中接着解析
  */
-HTTP_CODE parse_headers(char* temp)
+void serve_connection(int fd)
 {
-	/* 遇到空行，此处已经被request_line函数将\r\n替换为两个结束符，HTTP请求正确 */
-	if (temp[0] == '\0')
-	{
-		return GET_REQUEST;
-	}
-	else if (strncasecmp(temp, "Host:", 5) == 0) // 只打印Host参数的值
-	{
-		temp += 5;
-		temp += strspn(temp, " \t");
-		printf("Teh request host is: %s\n", temp);
-	}
-	else  // 其他参数暂时忽略
-	{
-		printf("I can not handle this header\n");
-	}
-	return NO_REQUEST;
-}
-
-/* 分析HTTP请求入口函数 */
-HTTP_CODE parse_content(char* buffer, int &checked_index, CHECK_STATE &checkstats, int &read_index, int &start_line)
-{
-	LINE_STATUS linestatus = LINE_OK; // 当前行读取状态
-	HTTP_CODE retcode = NO_REQUEST;   // 记录HTTP请求的处理结果
-	while ( (linestatus = parse_line(buffer, checked_index, read_index)) == LINE_OK )
+	chain_buffer buffer(BUFFER_SIZE);
+	int data_read = 0;
+	int read_index = 0;
+	int start_line = 0;
+	int checked_index = 0;
+	int request_start = 0; // 当前请求在缓冲区中的起始位置
+	CHECK_STATE checkstats = CHECK_STATE_REQUESTLINE;
+	http_request request;
+	request.body_cb = drop_body;
+	struct iovec iv[MAX_PIPELINE * 2]; // 每个应答的头部和消息体各占一项
+	bool alive = true;
+	while (alive)
 	{
-		char* temp = buffer + start_line;
-		start_line = checked_index;
-		switch (checkstats)
+		if (buffer.has_more())
 		{
-			case CHECK_STATE_REQUESTLINE:
+			/* 第一块已经解析完，把当前请求未处理的部分和后面读入的数据拼成连续的一段 */
+			const char* from = buffer.data() + request_start;
+			int keep = buffer.linearize(request_start);
+			if (keep < 0) // 一个请求超出了缓冲区的上限
 			{
-				retcode = parse_requestline(temp, checkstats);
-				if (retcode == BAD_REQUEST)
-				{
-					return BAD_REQUEST;
-				}
+				struct iovec bad[2];
+				writev_all(fd, bad, bad_reply.fill_iov(bad));
 				break;
 			}
-			case CHECK_STATE_HEADER:
+			request.rebase(from, buffer.data() + keep);
+			request.body_offset += keep - request_start;
+			start_line += keep - request_start;
+			checked_index += keep - request_start;
+			request_start = keep;
+		}
+		else
+		{
+			if (request_start == buffer.size())
 			{
-				retcode = parse_headers(temp);
-				if (retcode == BAD_REQUEST)
-				{
-					return BAD_REQUEST;
-				}
-				else if (retcode == GET_REQUEST)
-				{
-					return GET_REQUEST;
-				}
+				/* 之前的请求都处理完了，直接从头开始，不需要移动数据 */
+				buffer.rewind();
+				start_line = checked_index = request_start = 0;
+			}
+			data_read = buffer.read(fd);
+			if (data_read == -1)
+			{
+				if (errno == EINTR) continue;
+				printf("reading failed\n");
 				break;
 			}
-			default:
+			else if (data_read == 0)
 			{
-				return INTERNAL_ERROR;
+				printf("remote client has closed the connection\n");
+				break;
 			}
 		}
-	}
-	if (linestatus == LINE_OPEN)
-	{
-		return NO_REQUEST;
-	}
-	else
-	{
-		return BAD_REQUEST;
+		read_index = buffer.size();
+
+		int iv_count = 0;
+		int replies = 0;
+		while (alive)
+		{
+			HTTP_CODE result = parse_content(buffer.data(), checked_index, checkstats, read_index, start_line, request);
+			if (result == NO_REQUEST)
+			{
+				break;
+			}
+			else if (result == GET_REQUEST)
+			{
+				printf("%.*s %.*s body %llu bytes\n", (int)request.method.size(), request.method.data(),
+					(int)request.url.size(), request.url.data(), (unsigned long long)request.body_received);
+				alive = keep_alive(request);
+				iv_count += ok_reply.fill_iov(iv + iv_count);
+				++replies;
+				/* 原地重置解析状态，下一个请求从checked_index开始 */
+				checkstats = CHECK_STATE_REQUESTLINE;
+				request.reset();
+				request_start = start_line = checked_index;
+			}
+			else
+			{
+				iv_count += bad_reply.fill_iov(iv + iv_count);
+				++replies;
+				alive = false;
+			}
+			if (replies == MAX_PIPELINE)
+			{
+				if (!writev_all(fd, iv, iv_count)) alive = false;
+				iv_count = replies = 0;
+			}
+		}
+		if (iv_count > 0 && !writev_all(fd, iv, iv_count))
+		{
+			break;
+		}
+		if (checkstats == CHECK_STATE_CONTENT && start_line > request.body_offset)
+		{
+			/* 已经交出去的消息体不再保留，缓冲区中只剩请求行、头部和没分析完的块大小行 */
+			int len = start_line - request.body_offset;
+			buffer.erase(request.body_offset, start_line);
+			checked_index -= len;
+			start_line -= len;
+		}
 	}
 }
 
@@ -237,53 +184,20 @@ int main(int argc, char const *argv[])
 	assert(ret != -1);
 	ret = listen(listenfd, 5);
 	assert(ret != -1);
-	struct sockaddr_in client_address;
-	socklen_t client_addrlength = sizeof(client_address);
-	int fd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
-	if (fd < 0)
-	{
-		printf("errno is : %d\n", errno);
-	}
-
-	char buffer[BUFFER_SIZE];
-	memset(buffer, '\0', BUFFER_SIZE);
-	int data_read = 0;
-	int read_index = 0;
-	int start_line = 0;
-	int checked_index = 0;
-	CHECK_STATE checkstats = CHECK_STATE_REQUESTLINE;
 	while (1)
 	{
-		data_read = recv(fd, buffer + read_index, BUFFER_SIZE - read_index, 0);
-		if (data_read == -1)
+		struct sockaddr_in client_address;
+		socklen_t client_addrlength = sizeof(client_address);
+		int fd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+		if (fd < 0)
 		{
-			printf("reading failed\n");
-			break;
-		}
-		else if (data_read == 0)
-		{
-			printf("remote client has closed the connection\n");
-			break;
-		}
-		read_index += data_read;
-		HTTP_CODE result = parse_content(buffer, checked_index, checkstats, read_index, start_line);
-
-		if (result == NO_REQUEST)
-		{
-			continue;
-		}
-		else if (result == GET_REQUEST)
-		{
-			send(fd, szret[0], strlen(szret[0]), 0);
-			break;
-		}
-		else
-		{
-			send(fd, szret[1], strlen(szret[1]), 0);
+			printf("errno is : %d\n", errno);
+			if (errno == EINTR) continue;
 			break;
 		}
+		serve_connection(fd);
+		close(fd);
 	}
-	close(fd);
 	close(listenfd);
 	return 0;
-}
\ No newline at end of file
+}
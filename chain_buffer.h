@@ -0,0 +1,267 @@
+#ifndef CHAIN_BUFFER
+#define CHAIN_BUFFER
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stddef.h>
+#include <string.h>
+#include <new>
+
+/**
+ * 可增长的链式接收缓冲区
+ * 缓冲区由若干块组成，块按大小分级（2KB、4KB ... 64KB），每级有一个线程局部的空闲链表，
+ * 分配和回收只是链表操作。一般的请求只用一个2KB的块，大的请求才会用到大块
+ *
+ * 解析器只看第一块（head）中连续的数据，下标相对于data()：
+ *   read()        用readv同时读入最后一块的剩余空间和一个新块，多出来的数据链在后面
+ *   linearize()   解析到第一块末尾还没结束时，把第一块中未处理的部分和下一块拼成连续的一段：
+ *                 新块读入时在前面留有空间，未处理的部分不长时只需把它复制到下一块前面，
+ *                 读入的数据不需要移动；放不下时才分配更大的块，把两部分都复制过去
+ *   rewind()      数据全部处理完时直接回到块的开头，不需要移动数据
+ *   erase()       删去第一块中已经处理过的一段（例如流式交出的消息体），使占用的内存不随消息体增长
+ */
+
+#define CHAIN_CHUNK_MIN 2048    // 最小的块
+#define CHAIN_CHUNK_CLASSES 6   // 块的级数，最大的块为 2KB << 5 = 64KB
+#define CHAIN_HEADROOM 256      // 新块前面预留的空间，用来拼接上一块中未处理的数据
+#define CHAIN_POOL_KEEP 64      // 每级空闲链表最多保留的块数，多余的还给系统
+
+struct buffer_chunk
+{
+	buffer_chunk* next;
+	int cls;   // 所在的级
+	int size;  // 数据区的大小
+	int begin; // 有效数据的起始位置
+	int end;   // 有效数据的结束位置
+	char* data() { return (char*)(this + 1); }
+};
+
+/* 按级分配块的线程局部池 */
+class chunk_pool
+{
+public:
+	static chunk_pool& local()
+	{
+		static thread_local chunk_pool pool;
+		return pool;
+	}
+
+	~chunk_pool()
+	{
+		for (int i = 0; i < CHAIN_CHUNK_CLASSES; ++i)
+		{
+			while (free_list[i])
+			{
+				buffer_chunk* chunk = free_list[i];
+				free_list[i] = chunk->next;
+				::operator delete(chunk);
+			}
+		}
+	}
+
+	/* 能容纳size字节的最小的级，超出最大的块时返回-1 */
+	static int class_of(int size)
+	{
+		for (int i = 0; i < CHAIN_CHUNK_CLASSES; ++i)
+		{
+			if (size <= (CHAIN_CHUNK_MIN << i)) return i;
+		}
+		return -1;
+	}
+
+	buffer_chunk* alloc(int cls)
+	{
+		buffer_chunk* chunk = free_list[cls];
+		if (chunk)
+		{
+			free_list[cls] = chunk->next;
+			--free_count[cls];
+		}
+		else
+		{
+			int size = CHAIN_CHUNK_MIN << cls;
+			chunk = (buffer_chunk*)::operator new(sizeof(buffer_chunk) + size);
+			chunk->cls = cls;
+			chunk->size = size;
+		}
+		chunk->next = NULL;
+		chunk->begin = chunk->end = 0;
+		return chunk;
+	}
+
+	void free(buffer_chunk* chunk)
+	{
+		int cls = chunk->cls;
+		if (free_count[cls] >= CHAIN_POOL_KEEP)
+		{
+			::operator delete(chunk);
+			return;
+		}
+		chunk->next = free_list[cls];
+		free_list[cls] = chunk;
+		++free_count[cls];
+	}
+
+private:
+	chunk_pool()
+	{
+		for (int i = 0; i < CHAIN_CHUNK_CLASSES; ++i)
+		{
+			free_list[i] = NULL;
+			free_count[i] = 0;
+		}
+	}
+
+	buffer_chunk* free_list[CHAIN_CHUNK_CLASSES];
+	int free_count[CHAIN_CHUNK_CLASSES];
+};
+
+class chain_buffer
+{
+public:
+	/* max_size为一个请求（需要连续存放的数据）的最大长度 */
+	chain_buffer(int max = CHAIN_CHUNK_MIN << (CHAIN_CHUNK_CLASSES - 1)): head(NULL), tail(NULL), max_size(max) {}
+	~chain_buffer()
+	{
+		clear();
+	}
+
+	/* 第一块的数据区，解析器的下标都相对于这里 */
+	char* data()
+	{
+		if (!head) head = tail = chunk_pool::local().alloc(0);
+		return head->data();
+	}
+
+	/* 第一块中有效数据的结束位置，即解析器的read_index */
+	int size() const { return head ? head->end : 0; }
+
+	/* 第一块后面是否还有读入的数据 */
+	bool has_more() const { return head && head->next; }
+
+	/* 数据都已处理完，回到块的开头；第一块是大块时换回最小的块 */
+	void rewind()
+	{
+		if (!head) return;
+		if (head->next || head->cls > 0)
+		{
+			clear();
+			return;
+		}
+		head->begin = head->end = 0;
+	}
+
+	/* 归还所有的块，空闲连接不占用缓冲区 */
+	void clear()
+	{
+		chunk_pool& pool = chunk_pool::local();
+		while (head)
+		{
+			buffer_chunk* next = head->next;
+			pool.free(head);
+			head = next;
+		}
+		tail = NULL;
+	}
+
+	/* 读入数据，返回值与recv相同 */
+	ssize_t read(int fd)
+	{
+		chunk_pool& pool = chunk_pool::local();
+		data();
+		buffer_chunk* spare = pool.alloc(0);
+		spare->begin = spare->end = CHAIN_HEADROOM;
+		struct iovec iv[2];
+		int count = 0;
+		int room = tail->size - tail->end;
+		if (room > 0)
+		{
+			iv[count].iov_base = tail->data() + tail->end;
+			iv[count].iov_len = room;
+			++count;
+		}
+		iv[count].iov_base = spare->data() + spare->end;
+		iv[count].iov_len = spare->size - spare->end;
+		++count;
+		ssize_t ret = readv(fd, iv, count);
+		if (ret <= 0)
+		{
+			pool.free(spare);
+			return ret;
+		}
+		if (ret <= room)
+		{
+			tail->end += ret;
+			pool.free(spare);
+			return ret;
+		}
+		tail->end += room;
+		spare->end += ret - room;
+		tail->next = spare;
+		tail = spare;
+		return ret;
+	}
+
+	/**
+	 * 解析到第一块末尾时调用（has_more()为真），把第一块中从keep开始的未处理数据与下一块拼成连续的一段
+	 * 返回keep的新位置，解析器的下标和已有的切片都要随之平移；需要的连续空间超过max_size时返回-1
+	 */
+	int linearize(int keep)
+	{
+		chunk_pool& pool = chunk_pool::local();
+		buffer_chunk* next = head->next;
+		int len = head->end - keep;
+		if (len <= next->begin)
+		{
+			/* 常见的情况：未处理的部分很短（或者没有），复制到下一块预留的空间中 */
+			memcpy(next->data() + next->begin - len, head->data() + keep, len);
+			next->begin -= len;
+			pool.free(head);
+			head = next;
+			return next->begin;
+		}
+		int total = len + next->end - next->begin;
+		if (total > max_size) return -1;
+		/* 放不下时换一个更大的块，多留一半的空间给后面读入的数据 */
+		int cls = chunk_pool::class_of(total + total / 2);
+		if (cls < 0) cls = chunk_pool::class_of(total);
+		buffer_chunk* chunk = pool.alloc(cls);
+		memcpy(chunk->data(), head->data() + keep, len);
+		memcpy(chunk->data() + len, next->data() + next->begin, next->end - next->begin);
+		chunk->end = total;
+		chunk->next = next->next;
+		if (tail == next) tail = chunk;
+		pool.free(head);
+		pool.free(next);
+		head = chunk;
+		return 0;
+	}
+
+	/* 从第一块中删去[from, to)，后面的数据前移；用于丢弃已经交给处理函数的消息体，后面剩下的通常很少 */
+	void erase(int from, int to)
+	{
+		memmove(head->data() + from, head->data() + to, head->end - to);
+		head->end -= to - from;
+	}
+
+	/* 占用的内存 */
+	size_t memory_usage() const
+	{
+		size_t bytes = 0;
+		for (buffer_chunk* chunk = head; chunk; chunk = chunk->next)
+		{
+			bytes += sizeof(buffer_chunk) + chunk->size;
+		}
+		return bytes;
+	}
+
+private:
+	chain_buffer(const chain_buffer&);
+	chain_buffer& operator=(const chain_buffer&);
+
+	buffer_chunk* head;
+	buffer_chunk* tail;
+	int max_size;
+};
+
+#endif
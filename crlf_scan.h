@@ -0,0 +1,92 @@
+#ifndef CRLF_SCAN
+#define CRLF_SCAN
+
+#include <stddef.h>
+
+/**
+ * 查找行结束符：返回[p, end)中第一个'\r'或'\n'的位置，没有则返回end
+ * 解析HTTP头部时绝大多数字节都不是行结束符，逐字节比较是最热的循环，
+ * 这里一次比较16（SSE2）或32（AVX2）个字节：两次cmpeq后取movemask，最低的置位即第一个结束符
+ * x86-64上SSE2总是可用；AVX2在第一次调用时按CPU特性选择
+ * 其他平台或者定义了CRLF_SCAN_SCALAR时只使用标量版本，结果与向量版本完全相同
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && !defined(CRLF_SCAN_SCALAR)
+#define CRLF_SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* 标量版本，也用于处理向量版本剩下的不足一个向量的尾部 */
+static inline const char* crlf_scan_scalar(const char* p, const char* end)
+{
+	for (; p < end; ++p)
+	{
+		if (*p == '\r' || *p == '\n') return p;
+	}
+	return end;
+}
+
+#ifdef CRLF_SCAN_X86
+static inline const char* crlf_scan_sse2(const char* p, const char* end)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	while (end - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if (mask) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+	return crlf_scan_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static inline const char* crlf_scan_avx2(const char* p, const char* end)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	while (end - p >= 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+		if (mask) return p + __builtin_ctz(mask);
+		p += 32;
+	}
+	/* 剩下不足32字节时交给SSE2版本 */
+	return crlf_scan_sse2(p, end);
+}
+#endif
+
+typedef const char* (*crlf_scan_fn)(const char*, const char*);
+
+/* 按CPU特性选择实现 */
+static inline crlf_scan_fn crlf_scan_select()
+{
+#ifdef CRLF_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return crlf_scan_avx2;
+	return crlf_scan_sse2;
+#else
+	return crlf_scan_scalar;
+#endif
+}
+
+/* 当前使用的实现的名字 */
+static inline const char* crlf_scan_name()
+{
+#ifdef CRLF_SCAN_X86
+	crlf_scan_fn fn = crlf_scan_select();
+	return fn == crlf_scan_avx2 ? "avx2" : "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+static inline const char* crlf_scan(const char* p, const char* end)
+{
+	static const crlf_scan_fn fn = crlf_scan_select();
+	return fn(p, end);
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef FD_CACHE
+#define FD_CACHE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * 打开的文件描述符和文件属性的缓存
+ * 每个路径只open和fstat一次，之后的请求直接取缓存的fd和stat结果，不再做路径查找
+ * 文件的变化由inotify通知：修改、属性变化（包括链接数变化，即删除或者被rename覆盖）、移走时使缓存项失效，
+ * 下一次访问重新打开。调用者需要在inotify的fd可读时（或者每次处理请求前）调用process_events()
+ * 缓存项有引用计数：失效或者被淘汰的项等最后一个使用者release之后才关闭fd
+ * 缓存的项数有上限，超出时按LRU淘汰；inotify不可用时不缓存，每次都重新打开
+ * 需要时（例如用mincore检查页缓存）可以取得文件的只读映射，每个缓存项只映射一次，随缓存项释放
+ */
+
+#define FD_CACHE_MAX 1024 /* 缓存的文件数上限 */
+
+struct fd_entry
+{
+	std::string path;
+	int fd;
+	struct stat st;   // 打开时的文件属性
+	int wd;           // inotify的watch，没有时为-1
+	int refs;
+	bool cached;
+	void* map;        // 整个文件的只读映射，NULL表示还没有映射，MAP_FAILED表示无法映射
+	fd_entry* prev;   // LRU链表，表头是最近访问的
+	fd_entry* next;
+
+	fd_entry(): fd(-1), wd(-1), refs(0), cached(false), map(NULL), prev(NULL), next(NULL) {}
+	~fd_entry()
+	{
+		if (map && map != MAP_FAILED) munmap(map, st.st_size);
+		if (fd >= 0) close(fd);
+	}
+
+	/* 文件（打开时的大小）的只读映射，第一次调用时建立；空文件或者无法映射时返回NULL */
+	const char* mapping()
+	{
+		if (!map) map = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+		return map == MAP_FAILED ? NULL : (const char*)map;
+	}
+};
+
+class fd_cache
+{
+public:
+	fd_cache(size_t max = FD_CACHE_MAX): head(NULL), tail(NULL), max_entries(max),
+		hits(0), misses(0), invalidations(0), evictions(0)
+	{
+		inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	}
+	~fd_cache()
+	{
+		clear();
+		if (inotifyfd >= 0) close(inotifyfd);
+	}
+
+	/* 注册到epoll中的fd，可读时调用process_events()；inotify不可用时为-1 */
+	int notify_fd() const { return inotifyfd; }
+
+	/**
+	 * 取得path对应的打开的文件，失败时返回NULL，errno为open或者fstat的错误
+	 * 用完后必须调用release
+	 */
+	fd_entry* acquire(std::string_view path)
+	{
+		auto it = entries.find(path);
+		if (it != entries.end())
+		{
+			++hits;
+			fd_entry* entry = it->second;
+			touch(entry);
+			++entry->refs;
+			return entry;
+		}
+		++misses;
+		fd_entry* entry = new fd_entry;
+		entry->path.assign(path.data(), path.size());
+		/* 先建立watch再open和fstat：fstat之后文件的任何变化都一定会产生通知，缓存的属性不会漏掉变化 */
+		if (inotifyfd >= 0)
+		{
+			entry->wd = inotify_add_watch(inotifyfd, entry->path.c_str(),
+				IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+		}
+		entry->fd = open(entry->path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (entry->fd < 0 || fstat(entry->fd, &entry->st) < 0)
+		{
+			int save_errno = errno;
+			/* 同一个inode的watch可能正被其他缓存项使用 */
+			if (entry->wd >= 0 && watches.find(entry->wd) == watches.end()) inotify_rm_watch(inotifyfd, entry->wd);
+			delete entry;
+			errno = save_errno;
+			return NULL;
+		}
+		++entry->refs;
+		if (entry->wd < 0) return entry; // inotify不可用或者无法监视的文件不缓存
+		entry->cached = true;
+		entries.emplace(std::string_view(entry->path), entry);
+		watches.emplace(entry->wd, entry);
+		link_front(entry);
+		if (entries.size() > max_entries)
+		{
+			++evictions;
+			detach(tail);
+		}
+		return entry;
+	}
+
+	void release(fd_entry* entry)
+	{
+		if (--entry->refs == 0 && !entry->cached) delete entry;
+	}
+
+	/* 读出所有的inotify事件，使对应的缓存项失效；返回失效的项数 */
+	int process_events()
+	{
+		if (inotifyfd < 0) return 0;
+		int count = 0;
+		char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		while (true)
+		{
+			ssize_t len = read(inotifyfd, buf, sizeof(buf));
+			if (len < 0 && errno == EINTR) continue;
+			if (len <= 0) break;
+			for (char* p = buf; p < buf + len; )
+			{
+				struct inotify_event* event = (struct inotify_event*)p;
+				p += sizeof(struct inotify_event) + event->len;
+				if (event->mask & IN_Q_OVERFLOW)
+				{
+					/* 丢失了事件，无法知道哪些文件变了，全部作废 */
+					count += entries.size();
+					clear();
+					continue;
+				}
+				/* 同一个文件（例如硬链接）的多个路径共用一个watch */
+				while (true)
+				{
+					auto it = watches.find(event->wd);
+					if (it == watches.end()) break;
+					++invalidations;
+					++count;
+					detach(it->second);
+				}
+			}
+		}
+		return count;
+	}
+
+	void clear()
+	{
+		while (tail) detach(tail);
+	}
+
+	size_t size() const { return entries.size(); }
+
+	void dump(FILE* out, const char* name) const
+	{
+		fprintf(out, "%s: %zu files, %llu hits, %llu misses, %llu invalidations, %llu evictions\n", name,
+			entries.size(), (unsigned long long)hits, (unsigned long long)misses,
+			(unsigned long long)invalidations, (unsigned long long)evictions);
+	}
+
+private:
+	fd_cache(const fd_cache&);
+	fd_cache& operator=(const fd_cache&);
+
+	/* 移出缓存，没有人使用时立即关闭 */
+	void detach(fd_entry* entry)
+	{
+		entries.erase(std::string_view(entry->path));
+		auto range = watches.equal_range(entry->wd);
+		int others = 0;
+		for (auto it = range.first; it != range.second; )
+		{
+			if (it->second == entry) it = watches.erase(it);
+			else
+			{
+				++others;
+				++it;
+			}
+		}
+		/* 同一个inode的watch只有一个，最后一个路径移出时才删除；文件已被删除时内核已经删掉了watch，忽略错误 */
+		if (others == 0) inotify_rm_watch(inotifyfd, entry->wd);
+		unlink(entry);
+		entry->cached = false;
+		if (entry->refs == 0) delete entry;
+	}
+
+	void link_front(fd_entry* entry)
+	{
+		entry->prev = NULL;
+		entry->next = head;
+		if (head) head->prev = entry;
+		head = entry;
+		if (!tail) tail = entry;
+	}
+
+	void unlink(fd_entry* entry)
+	{
+		if (entry->prev) entry->prev->next = entry->next;
+		else head = entry->next;
+		if (entry->next) entry->next->prev = entry->prev;
+		else tail = entry->prev;
+		entry->prev = entry->next = NULL;
+	}
+
+	void touch(fd_entry* entry)
+	{
+		if (entry == head) return;
+		unlink(entry);
+		link_front(entry);
+	}
+
+	int inotifyfd;
+	std::unordered_map<std::string_view, fd_entry*> entries;
+	std::unordered_multimap<int, fd_entry*> watches; // inotify的wd -> 缓存项
+	fd_entry* head;
+	fd_entry* tail;
+	size_t max_entries;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t invalidations;
+	uint64_t evictions;
+};
+
+#endif
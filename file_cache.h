@@ -0,0 +1,204 @@
+#ifndef FILE_CACHE
+#define FILE_CACHE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string_view>
+#include <unordered_map>
+#include "response_cache.h"
+
+/**
+ * 静态文件缓存
+ * 每个文件只读地mmap一次，和预先序列化的头部放在一起；应答直接writev头部和映射的页面，
+ * 热点文件重复访问时既不需要read也不需要分配内存
+ * 缓存的映射总大小不超过上限，超出时按LRU淘汰最久没有访问的文件
+ * acquire()和release()成对使用：正在发送的文件即使被淘汰或者发现已经修改，也要等release之后才解除映射
+ */
+
+#define FILE_CACHE_MAX_BYTES (64 << 20) /* 缓存的映射总大小的上限 */
+
+struct file_entry : public cached_response
+{
+	void* map;        // 只读映射，空文件为NULL；引用计数和是否在缓存中用基类的refs和cached
+	file_entry* prev; // LRU链表，表头是最近访问的
+	file_entry* next;
+
+	file_entry(): map(NULL), prev(NULL), next(NULL) {}
+	~file_entry()
+	{
+		if (map) munmap(map, size);
+	}
+
+	/* 填写头部和映射的文件内容，返回用掉的iovec个数（1或2） */
+	int fill_iov(struct iovec* iv) const
+	{
+		iv[0].iov_base = (void*)header.data();
+		iv[0].iov_len = header.size();
+		if (size == 0) return 1;
+		iv[1].iov_base = map;
+		iv[1].iov_len = size;
+		return 2;
+	}
+};
+
+class file_cache
+{
+public:
+	file_cache(size_t max = FILE_CACHE_MAX_BYTES): head(NULL), tail(NULL), max_bytes(max), bytes(0),
+		hits(0), misses(0), evictions(0) {}
+	~file_cache()
+	{
+		clear();
+	}
+
+	/**
+	 * 取得path对应的文件，st是调用者刚取得的文件属性，文件有变化时重新映射
+	 * 返回NULL表示文件无法打开或者映射；用完后必须调用release
+	 * 比上限还大的文件不进入缓存，release时直接解除映射
+	 * fd是已经打开的文件（例如来自fd_cache），为-1时按path打开
+	 */
+	file_entry* acquire(std::string_view path, const struct stat& st, int fd = -1)
+	{
+		auto it = entries.find(path);
+		if (it != entries.end())
+		{
+			file_entry* entry = it->second;
+			if (entry->fresh(st))
+			{
+				++hits;
+				touch(entry);
+				++entry->refs;
+				return entry;
+			}
+			detach(entry);
+		}
+		++misses;
+		file_entry* entry = load(path, st, fd);
+		if (!entry) return NULL;
+		++entry->refs;
+		if ((size_t)entry->size <= max_bytes)
+		{
+			entry->cached = true;
+			entries.emplace(std::string_view(entry->url), entry);
+			link_front(entry);
+			bytes += entry->size;
+			while (bytes > max_bytes)
+			{
+				++evictions;
+				detach(tail);
+			}
+		}
+		return entry;
+	}
+
+	void release(file_entry* entry)
+	{
+		if (--entry->refs == 0 && !entry->cached) delete entry;
+	}
+
+	/* 从缓存中去掉path，例如知道文件已经被删除时 */
+	void remove(std::string_view path)
+	{
+		auto it = entries.find(path);
+		if (it != entries.end()) detach(it->second);
+	}
+
+	void clear()
+	{
+		while (tail) detach(tail);
+	}
+
+	size_t memory_usage() const { return bytes; }
+
+	void dump(FILE* out, const char* name) const
+	{
+		fprintf(out, "%s: %zu files, %zu bytes mapped, %llu hits, %llu misses, %llu evictions\n", name,
+			entries.size(), bytes, (unsigned long long)hits, (unsigned long long)misses,
+			(unsigned long long)evictions);
+	}
+
+private:
+	file_cache(const file_cache&);
+	file_cache& operator=(const file_cache&);
+
+	/* 打开并映射文件，生成头部；映射之后自己打开的文件描述符就不需要了 */
+	static file_entry* load(std::string_view path, const struct stat& st, int fd)
+	{
+		file_entry* entry = new file_entry;
+		entry->url.assign(path.data(), path.size());
+		if (st.st_size > 0)
+		{
+			int mapfd = fd >= 0 ? fd : open(entry->url.c_str(), O_RDONLY);
+			if (mapfd < 0)
+			{
+				delete entry;
+				return NULL;
+			}
+			void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, mapfd, 0);
+			if (mapfd != fd) close(mapfd);
+			if (map == MAP_FAILED)
+			{
+				delete entry;
+				return NULL;
+			}
+			entry->map = map;
+		}
+		entry->size = st.st_size;
+		entry->mtime = st.st_mtim.tv_sec;
+		entry->mtime_nsec = st.st_mtim.tv_nsec;
+		entry->header = serialize_header("200 OK", mime_type(path), st.st_size, st.st_mtim.tv_sec, NULL);
+		return entry;
+	}
+
+	/* 移出缓存，没有人使用时立即释放 */
+	void detach(file_entry* entry)
+	{
+		entries.erase(std::string_view(entry->url));
+		unlink(entry);
+		bytes -= entry->size;
+		entry->cached = false;
+		if (entry->refs == 0) delete entry;
+	}
+
+	void link_front(file_entry* entry)
+	{
+		entry->prev = NULL;
+		entry->next = head;
+		if (head) head->prev = entry;
+		head = entry;
+		if (!tail) tail = entry;
+	}
+
+	void unlink(file_entry* entry)
+	{
+		if (entry->prev) entry->prev->next = entry->next;
+		else head = entry->next;
+		if (entry->next) entry->next->prev = entry->prev;
+		else tail = entry->prev;
+		entry->prev = entry->next = NULL;
+	}
+
+	void touch(file_entry* entry)
+	{
+		if (entry == head) return;
+		unlink(entry);
+		link_front(entry);
+	}
+
+	std::unordered_map<std::string_view, file_entry*> entries;
+	file_entry* head;
+	file_entry* tail;
+	size_t max_bytes;
+	size_t bytes;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef HEAP_TIMER
+#define HEAP_TIMER
+
+#include <time.h>
+#include <stdio.h>
+#include "lst_timer.h"
+
+/**
+ * 时间堆，接口与sort_timer_lst相同，底层是带下标索引的4叉最小堆
+ * 每个定时器节点（默认为util_timer）记录自己在堆数组中的下标，调整和删除都无需查找
+ * 添加O(log n)，调整O(log n)，删除O(log n)，取最早到期时间O(1)
+ * 堆数组中连续存放(expire, timer)对，比较时不需要解引用定时器节点
+ */
+
+#define HEAP_ARITY 4
+
+template<typename Timer = util_timer>
+class basic_time_heap
+{
+public:
+	basic_time_heap(int cap = 64, timer_clock* clk = NULL): capacity(cap), cur_size(0), clock(clk ? clk : real_clock::wall())
+	{
+		if (capacity < 1) capacity = 1;
+		array = new heap_entry[capacity];
+	}
+	~basic_time_heap()
+	{
+		for (int i = 0; i < cur_size; ++i)
+		{
+			timer_pool<Timer>::destroy(array[i].timer);
+		}
+		expired.clear(release);
+		delete [] array;
+	}
+
+	/* 添加一个定时器到堆中 */
+	void add_timer(Timer* timer)
+	{
+		if (!timer) return;
+		stats.on_add();
+		insert(timer);
+	}
+
+	/* 定时器的expire被修改后调用，延长和缩短都可以 */
+	void adjust_timer(Timer* timer)
+	{
+		if (!timer) return;
+		if (timer->pending)
+		{
+			/* 已经到期但回调还没执行，放回堆中 */
+			expired.remove(timer);
+			insert(timer);
+			return;
+		}
+		if (timer->heap_index < 0) return;
+		int hole = timer->heap_index;
+		array[hole].expire = timer->expire;
+		if (hole > 0 && timer->expire < array[parent(hole)].expire) sift_up(hole);
+		else sift_down(hole);
+	}
+
+	void del_timer(Timer* timer)
+	{
+		if (!timer) return;
+		if (timer->pending)
+		{
+			expired.remove(timer);
+			stats.on_del();
+		}
+		else if (timer->heap_index >= 0)
+		{
+			remove(timer->heap_index);
+			stats.on_del();
+		}
+		timer_pool<Timer>::destroy(timer);
+	}
+
+	/* 最早到期的时间，堆为空时返回-1，事件循环可据此设置等待时间 */
+	time_t next_expiry() const
+	{
+		return cur_size > 0 ? array[0].expire : -1;
+	}
+
+	bool empty() const { return cur_size == 0; }
+	/* 容器自身占用的字节数，不含定时器节点 */
+	size_t memory_usage() const { return sizeof(*this) + capacity * sizeof(heap_entry); }
+	int size() const { return cur_size; }
+	const timer_stats& get_stats() const { return stats; }
+
+	/* 设置每次tick执行回调的预算，0表示不限制 */
+	void set_budget(int max_count, uint64_t max_ns)
+	{
+		budget.max_count = max_count;
+		budget.max_ns = max_ns;
+	}
+
+	/* 是否还有已经到期、因为预算用完而没有执行的定时器 */
+	bool has_pending() const { return !expired.empty(); }
+
+	/* 处理堆中到期的定时器：先全部移到待执行队列，再在预算内执行回调 */
+	void tick()
+	{
+		uint64_t now = clock->now_ms();
+		time_t cut = now / 1000;
+		while (cur_size > 0 && array[0].expire <= cut)
+		{
+			Timer* tmp = array[0].timer;
+			if (tmp->timeout > 0 && cut < timer_last_active(tmp->user_data) + tmp->timeout)
+			{
+				/* 惰性定时器期间有过活动，按剩余的空闲时间下沉 */
+				tmp->expire = timer_last_active(tmp->user_data) + tmp->timeout;
+				array[0].expire = tmp->expire;
+				sift_down(0);
+				continue;
+			}
+			remove(0);
+			expired.push(tmp);
+		}
+		stats.on_tick(expired.dispatch(budget, now, 1000, stats, release));
+	}
+
+private:
+	struct heap_entry
+	{
+		time_t expire;
+		Timer* timer;
+	};
+
+	static int parent(int i) { return (i - 1) / HEAP_ARITY; }
+
+	static void release(Timer* timer)
+	{
+		timer_pool<Timer>::destroy(timer);
+	}
+
+	void insert(Timer* timer)
+	{
+		if (cur_size >= capacity) resize();
+		int hole = cur_size++;
+		array[hole].expire = timer->expire;
+		array[hole].timer = timer;
+		timer->heap_index = hole;
+		sift_up(hole);
+	}
+
+	void place(int i, const heap_entry& e)
+	{
+		array[i] = e;
+		e.timer->heap_index = i;
+	}
+
+	void sift_up(int hole)
+	{
+		heap_entry e = array[hole];
+		while (hole > 0)
+		{
+			int p = parent(hole);
+			if (array[p].expire <= e.expire) break;
+			place(hole, array[p]);
+			hole = p;
+		}
+		place(hole, e);
+	}
+
+	void sift_down(int hole)
+	{
+		heap_entry e = array[hole];
+		while (true)
+		{
+			int first = hole * HEAP_ARITY + 1;
+			if (first >= cur_size) break;
+			int last = first + HEAP_ARITY < cur_size ? first + HEAP_ARITY : cur_size;
+			int child = first;
+			for (int c = first + 1; c < last; ++c)
+			{
+				if (array[c].expire < array[child].expire) child = c;
+			}
+			if (e.expire <= array[child].expire) break;
+			place(hole, array[child]);
+			hole = child;
+		}
+		place(hole, e);
+	}
+
+	/* 从堆中移除下标为i的元素，用最后一个元素填补空位 */
+	void remove(int i)
+	{
+		array[i].timer->heap_index = -1;
+		if (--cur_size == i) return;
+		array[i] = array[cur_size];
+		array[i].timer->heap_index = i;
+		if (i > 0 && array[i].expire < array[parent(i)].expire) sift_up(i);
+		else sift_down(i);
+	}
+
+	/* 堆数组容量扩大一倍 */
+	void resize()
+	{
+		heap_entry* temp = new heap_entry[2 * capacity];
+		for (int i = 0; i < cur_size; ++i)
+		{
+			temp[i] = array[i];
+		}
+		capacity = 2 * capacity;
+		delete [] array;
+		array = temp;
+	}
+
+private:
+	heap_entry* array; // 堆数组
+	int capacity;      // 堆数组的容量
+	int cur_size;      // 堆数组当前包含元素的个数
+	timer_clock* clock;
+	timer_stats stats;
+	timer_batch<Timer> expired; // 已经到期、等待执行回调的定时器
+	timer_budget budget;
+};
+
+typedef basic_time_heap<> time_heap;
+
+#endif
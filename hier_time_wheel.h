@@ -0,0 +1,296 @@
+#ifndef HIER_TIME_WHEEL
+#define HIER_TIME_WHEEL
+
+#include <time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "timer_pool.h"
+#include "timer_clock.h"
+#include "timer_stats.h"
+#include "timer_batch.h"
+
+/**
+ * 分层（级联）时间轮，精度1毫秒
+ * 第0层256个槽，每槽1ms；第1~4层各64个槽，每槽跨度为下一层一整圈
+ * 覆盖范围 2^32 ms（约49.7天），更长的超时按最大值处理
+ * 添加O(1)，删除O(1)，tick的代价只与到期（以及被级联下移）的定时器数量有关，
+ * 而与时间轮中定时器的总数无关；高层的定时器每经过一层只会被搬移一次
+ */
+
+#define HW_ROOT_BITS 8
+#define HW_LEVEL_BITS 6
+#define HW_ROOT_SIZE (1 << HW_ROOT_BITS)
+#define HW_LEVEL_SIZE (1 << HW_LEVEL_BITS)
+#define HW_ROOT_MASK (HW_ROOT_SIZE - 1)
+#define HW_LEVEL_MASK (HW_LEVEL_SIZE - 1)
+#define HW_LEVELS 4 /* 除第0层之外的层数 */
+
+struct client_data;
+
+/* 节点以负载类型和回调类型为模板参数，默认的hw_timer回调为void(*)(client_data*) */
+template<typename T = client_data, typename Callback = void (*)(T*)>
+class basic_hw_timer
+{
+public:
+	typedef T data_type;
+	basic_hw_timer(): expire(0), seq(0), level(-1), slot(-1), pending(false), cb_func(), user_data(NULL), next(NULL), prev(NULL) {}
+
+	uint64_t expire; /* 到期时刻，毫秒级绝对时间 */
+	uint64_t seq;    /* 代号，由loop_timer分配，节点回收时清零，用于识别过期的句柄 */
+	int level;       /* 所在层，-1表示不在时间轮中 */
+	int slot;        /* 所在层中的槽 */
+	bool pending;    /* 已经到期，等待执行回调 */
+	Callback cb_func; /* 定时器回调函数 */
+	T* user_data;
+
+	basic_hw_timer* next;
+	basic_hw_timer* prev;
+};
+typedef basic_hw_timer<> hw_timer;
+
+template<typename Timer = hw_timer>
+class basic_hier_time_wheel
+{
+public:
+	/* clock为NULL时使用单调时钟 */
+	basic_hier_time_wheel(timer_clock* clk = NULL): clock(clk ? clk : real_clock::monotonic())
+	{
+		for (int i = 0; i < HW_ROOT_SIZE; ++i)
+		{
+			root[i] = NULL;
+		}
+		for (int l = 0; l < HW_LEVELS; ++l)
+		{
+			for (int i = 0; i < HW_LEVEL_SIZE; ++i)
+			{
+				levels[l][i] = NULL;
+			}
+		}
+		for (int i = 0; i < HW_ROOT_SIZE / 64; ++i)
+		{
+			root_bitmap[i] = 0;
+		}
+		jiffies = clock->now_ms();
+	}
+	~basic_hier_time_wheel()
+	{
+		for (int i = 0; i < HW_ROOT_SIZE; ++i)
+		{
+			free_list(root[i]);
+		}
+		for (int l = 0; l < HW_LEVELS; ++l)
+		{
+			for (int i = 0; i < HW_LEVEL_SIZE; ++i)
+			{
+				free_list(levels[l][i]);
+			}
+		}
+		expired.clear(release);
+	}
+
+	/* 时间轮所用时钟的当前时间（毫秒） */
+	uint64_t now_ms()
+	{
+		return clock->now_ms();
+	}
+
+	/* 根据定时值timeout（毫秒）创建一个定时器，并把它插入合适的槽中 */
+	Timer* add_timer(int timeout)
+	{
+		if (timeout < 0) return NULL;
+		if (timeout == 0) timeout = 1; // 不足1ms向上折合1ms
+		Timer* timer = timer_pool<Timer>::create();
+		timer->expire = now_ms() + timeout;
+		add_timer(timer);
+		stats.on_add();
+		return timer;
+	}
+
+	/* 删除目标定时器 */
+	void del_timer(Timer* timer)
+	{
+		if (!timer) return;
+		if (timer->pending) expired.remove(timer);
+		else unlink_timer(timer);
+		stats.on_del();
+		release(timer);
+	}
+
+	/* 把定时器改为从现在起timeout毫秒后到期 */
+	void adjust_timer(Timer* timer, int timeout)
+	{
+		if (!timer || timeout < 0) return;
+		if (timeout == 0) timeout = 1;
+		if (timer->pending) expired.remove(timer);
+		else unlink_timer(timer);
+		timer->expire = now_ms() + timeout;
+		add_timer(timer);
+	}
+
+	const timer_stats& get_stats() const { return stats; }
+
+	/* 设置每次tick执行回调的预算，0表示不限制 */
+	void set_budget(int max_count, uint64_t max_ns)
+	{
+		budget.max_count = max_count;
+		budget.max_ns = max_ns;
+	}
+
+	/* 是否还有已经到期、因为预算用完而没有执行的定时器 */
+	bool has_pending() const { return !expired.empty(); }
+
+	/* 将时间轮推进到当前时刻，把这期间到期的定时器摘到待执行队列，再在预算内执行回调 */
+	void tick()
+	{
+		uint64_t now = now_ms();
+		while (jiffies <= now)
+		{
+			int index = jiffies & HW_ROOT_MASK;
+			if (index == 0)
+			{
+				/* 第0层转完一圈，把上层对应槽中的定时器级联到下层 */
+				for (int l = 0; l < HW_LEVELS; ++l)
+				{
+					if (cascade(l) != 0) break;
+				}
+			}
+			else if (!root[index])
+			{
+				/* 当前槽为空，借助位图直接跳到下一个非空槽（或本圈结束、或当前时刻） */
+				uint64_t next = jiffies - index + next_root_slot(index);
+				jiffies = next <= now ? next : now + 1;
+				continue;
+			}
+
+			Timer* tmp;
+			while ((tmp = root[index]) != NULL)
+			{
+				unlink_timer(tmp);
+				expired.push(tmp);
+			}
+			++jiffies;
+		}
+		stats.on_tick(expired.dispatch(budget, now, 1, stats, release));
+	}
+
+private:
+	/* 按照到期时间与当前嘀嗒的差值选择层和槽 */
+	void add_timer(Timer* timer)
+	{
+		uint64_t expire = timer->expire;
+		uint64_t idx = expire - jiffies;
+		if ((int64_t)idx < 0)
+		{
+			/* 已经过期，放到当前槽，下一次tick立即执行 */
+			link_timer(timer, -1, jiffies & HW_ROOT_MASK);
+			return;
+		}
+		if (idx < HW_ROOT_SIZE)
+		{
+			link_timer(timer, -1, expire & HW_ROOT_MASK);
+			return;
+		}
+		if (idx > 0xffffffffULL)
+		{
+			idx = 0xffffffffULL;
+			expire = jiffies + idx;
+			timer->expire = expire;
+		}
+		int l = 0;
+		while (l < HW_LEVELS - 1 && idx >= (1ULL << (HW_ROOT_BITS + (l + 1) * HW_LEVEL_BITS)))
+		{
+			++l;
+		}
+		link_timer(timer, l, (expire >> (HW_ROOT_BITS + l * HW_LEVEL_BITS)) & HW_LEVEL_MASK);
+	}
+
+	/* level为-1表示第0层 */
+	void link_timer(Timer* timer, int level, int slot)
+	{
+		Timer** head = level < 0 ? &root[slot] : &levels[level][slot];
+		timer->level = level;
+		timer->slot = slot;
+		timer->prev = NULL;
+		timer->next = *head;
+		if (*head) (*head)->prev = timer;
+		else if (level < 0) root_bitmap[slot >> 6] |= 1ULL << (slot & 63);
+		*head = timer;
+	}
+
+	void unlink_timer(Timer* timer)
+	{
+		int slot = timer->slot;
+		Timer** head = timer->level < 0 ? &root[slot] : &levels[timer->level][slot];
+		if (timer == *head)
+		{
+			/* 如果是槽的头节点 */
+			*head = timer->next;
+			if (*head) (*head)->prev = NULL;
+			else if (timer->level < 0) root_bitmap[slot >> 6] &= ~(1ULL << (slot & 63));
+		}
+		else
+		{
+			timer->prev->next = timer->next;
+			if (timer->next) timer->next->prev = timer->prev;
+		}
+		timer->next = timer->prev = NULL;
+	}
+
+	/* 把第l层当前槽中的定时器重新分配到下面的层，返回该槽的下标 */
+	int cascade(int l)
+	{
+		int index = (jiffies >> (HW_ROOT_BITS + l * HW_LEVEL_BITS)) & HW_LEVEL_MASK;
+		Timer* tmp = levels[l][index];
+		levels[l][index] = NULL;
+		while (tmp)
+		{
+			Timer* next = tmp->next;
+			add_timer(tmp);
+			tmp = next;
+		}
+		return index;
+	}
+
+	/* 在第0层中从from开始寻找下一个非空槽，找不到返回HW_ROOT_SIZE */
+	int next_root_slot(int from)
+	{
+		for (int i = from >> 6; i < HW_ROOT_SIZE / 64; ++i)
+		{
+			uint64_t bits = root_bitmap[i];
+			if (i == (from >> 6)) bits &= ~0ULL << (from & 63);
+			if (bits) return (i << 6) + __builtin_ctzll(bits);
+		}
+		return HW_ROOT_SIZE;
+	}
+
+	/* 回收节点前清除代号，节点内存仍在池中，其他线程发来的过期消息据此被忽略 */
+	static void release(Timer* timer)
+	{
+		__atomic_store_n(&timer->seq, 0, __ATOMIC_RELAXED);
+		timer_pool<Timer>::destroy(timer);
+	}
+
+	static void free_list(Timer* tmp)
+	{
+		while (tmp)
+		{
+			Timer* next = tmp->next;
+			release(tmp);
+			tmp = next;
+		}
+	}
+
+private:
+	Timer* root[HW_ROOT_SIZE];                 // 第0层
+	Timer* levels[HW_LEVELS][HW_LEVEL_SIZE];   // 第1~4层
+	uint64_t root_bitmap[HW_ROOT_SIZE / 64];      // 第0层非空槽位图
+	uint64_t jiffies;                             // 下一个待处理的毫秒时刻
+	timer_clock* clock;
+	timer_stats stats;
+	timer_batch<Timer> expired;                   // 已经到期、等待执行回调的定时器
+	timer_budget budget;
+};
+
+typedef basic_hier_time_wheel<> hier_time_wheel;
+
+#endif
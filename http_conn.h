@@ -0,0 +1,251 @@
+#ifndef HTTP_CONN
+#define HTTP_CONN
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "chain_buffer.h"
+#include "http_parser.h"
+#include "response_cache.h"
+
+#define CONN_MAX_REQUEST 65536 /* 一个请求（请求行和头部）的最大长度 */
+#define CONN_MAX_PIPELINE 64   /* 发送队列中最多的应答个数，满了就暂停解析 */
+#define CONN_MAX_IOV (2 * CONN_MAX_PIPELINE) /* 每个应答最多占两个iovec（头部和消息体） */
+
+/* 简化设计，仅应答成功或者失败；与8-3.cpp相同，启动时序列化一次，Content-Length由make_response计算 */
+static const cached_response conn_ok_reply = make_response("200 OK", "text/html; charset=UTF-8", "I get a correct result\n");
+static const cached_response conn_bad_reply = make_response("400 Bad Request", "text/html; charset=UTF-8",
+	"Whoops, Sometion wrong\n", "Connection: close\r\n");
+
+/* serve()之后连接在等待什么 */
+enum CONN_STATUS
+{
+	CONN_READ = 0, // 等待socket可读
+	CONN_WRITE,    // 应答没有发完，等待socket可写
+	CONN_CLOSE     // 应该关闭连接
+};
+
+/**
+ * 一个HTTP连接的全部状态：接收缓冲区、解析器的下标和状态、解析出的请求和待发送的应答
+ * 8-3.cpp中serve_connection的局部变量都放在这里，这样一个线程可以在非阻塞的socket上同时服务很多连接
+ * socket必须是非阻塞的，并以ET模式同时注册EPOLLIN和EPOLLOUT：
+ *   可读时调用on_readable()，可写时调用on_writable()，二者都会调用serve()推进连接直到需要等待
+ * 只在解析器需要更多数据时才读入，发送队列满时暂停解析，因此一个连接缓冲的数据是有限的
+ */
+class http_conn
+{
+public:
+	http_conn(): sockfd(-1), buffer(CONN_MAX_REQUEST) {}
+
+	/* accept之后初始化 */
+	void init(int fd, const sockaddr_in& addr)
+	{
+		sockfd = fd;
+		address = addr;
+		read_index = start_line = checked_index = request_start = 0;
+		checkstats = CHECK_STATE_REQUESTLINE;
+		request.reset();
+		iv_count = 0;
+		input_ready = true;
+		closing = false;
+		requests = 0;
+	}
+
+	/* 关闭连接后回收缓冲区，对象留给下一个使用同一个fd的连接 */
+	void close_conn()
+	{
+		if (sockfd < 0) return;
+		close(sockfd);
+		sockfd = -1;
+		buffer.clear();
+		iv_count = 0;
+	}
+
+	int fd() const { return sockfd; }
+	uint64_t handled() const { return requests; }
+
+	CONN_STATUS on_readable()
+	{
+		input_ready = true;
+		return serve();
+	}
+
+	CONN_STATUS on_writable()
+	{
+		/* 没有待发送的应答时可写事件没有意义 */
+		if (iv_count == 0 && !input_ready) return CONN_READ;
+		return serve();
+	}
+
+	/**
+	 * 推进连接：解析缓冲区中的请求并把应答放入发送队列，发送，需要时再读入，直到必须等待I/O为止
+	 */
+	CONN_STATUS serve()
+	{
+		while (true)
+		{
+			bool need_input = parse();
+			if (!flush()) return CONN_CLOSE;
+			if (iv_count > 0) return CONN_WRITE;
+			if (closing) return CONN_CLOSE;
+			if (!need_input) continue; // 因为发送队列满而暂停的解析，发完后接着解析
+			if (!input_ready) return CONN_READ;
+			int ret = fill();
+			if (ret == 0) return CONN_CLOSE; // 对方关闭或者出错
+			if (ret < 0) return CONN_READ;   // EAGAIN，等待下一次可读
+		}
+	}
+
+private:
+	/* 读入一次数据，返回读到的字节数，0表示对方关闭或者出错，-1表示暂时没有数据 */
+	int fill()
+	{
+		if (request_start == buffer.size() && !buffer.has_more())
+		{
+			/* 之前的请求都处理完了，直接从头开始，不需要移动数据 */
+			buffer.rewind();
+			read_index = start_line = checked_index = request_start = 0;
+		}
+		while (true)
+		{
+			ssize_t ret = buffer.read(sockfd);
+			if (ret > 0) return (int)ret;
+			if (ret < 0 && errno == EINTR) continue;
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				/* ET模式下读到EAGAIN才算读完；没有未完成的请求时归还缓冲区，空闲连接不占内存 */
+				input_ready = false;
+				if (request_start == buffer.size() && !buffer.has_more()) buffer.clear();
+				return -1;
+			}
+			return 0;
+		}
+	}
+
+	/* 解析缓冲区中的请求，直到数据不够或者发送队列满；返回是否需要读入更多数据 */
+	bool parse()
+	{
+		bool need_input = false;
+		while (!closing && iv_count + 2 <= CONN_MAX_IOV)
+		{
+			if (request_start == buffer.size() && !buffer.has_more()) // 没有数据
+			{
+				need_input = true;
+				break;
+			}
+			read_index = buffer.size();
+			HTTP_CODE result = parse_content(buffer.data(), checked_index, checkstats, read_index, start_line, request);
+			if (result == NO_REQUEST)
+			{
+				if (!buffer.has_more())
+				{
+					need_input = true;
+					break;
+				}
+				drop_body();
+				/* 第一块已经解析完，把当前请求未处理的部分和后面读入的数据拼成连续的一段 */
+				const char* from = buffer.data() + request_start;
+				int keep = buffer.linearize(request_start);
+				if (keep < 0) // 一个请求超出了缓冲区的上限
+				{
+					queue_reply(conn_bad_reply);
+					closing = true;
+					break;
+				}
+				request.rebase(from, buffer.data() + keep);
+				request.body_offset += keep - request_start;
+				start_line += keep - request_start;
+				checked_index += keep - request_start;
+				request_start = keep;
+			}
+			else if (result == GET_REQUEST)
+			{
+				++requests;
+				closing = !keep_alive(request);
+				queue_reply(conn_ok_reply);
+				/* 原地重置解析状态，下一个请求从checked_index开始 */
+				checkstats = CHECK_STATE_REQUESTLINE;
+				request.reset();
+				request_start = start_line = checked_index;
+			}
+			else
+			{
+				queue_reply(conn_bad_reply);
+				closing = true;
+			}
+		}
+		drop_body();
+		return need_input;
+	}
+
+	/* 已经交出去的消息体不再保留，缓冲区中只剩请求行、头部和没分析完的块大小行 */
+	void drop_body()
+	{
+		if (checkstats == CHECK_STATE_CONTENT && start_line > request.body_offset)
+		{
+			int len = start_line - request.body_offset;
+			buffer.erase(request.body_offset, start_line);
+			checked_index -= len;
+			start_line -= len;
+		}
+	}
+
+	void queue_reply(const cached_response& reply)
+	{
+		iv_count += reply.fill_iov(iv + iv_count);
+	}
+
+	/* 用一次writev发送队列中所有的应答，返回false表示出错；socket写满时剩下的留在队列中 */
+	bool flush()
+	{
+		int first = 0;
+		while (first < iv_count)
+		{
+			ssize_t n = writev(sockfd, iv + first, iv_count - first);
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+				return false;
+			}
+			while (first < iv_count && (size_t)n >= iv[first].iov_len)
+			{
+				n -= iv[first].iov_len;
+				++first;
+			}
+			if (first < iv_count)
+			{
+				iv[first].iov_base = (char*)iv[first].iov_base + n;
+				iv[first].iov_len -= n;
+			}
+		}
+		if (first > 0)
+		{
+			memmove(iv, iv + first, (iv_count - first) * sizeof(struct iovec));
+			iv_count -= first;
+		}
+		return true;
+	}
+
+private:
+	int sockfd;
+	sockaddr_in address;
+	chain_buffer buffer;
+	int read_index;
+	int start_line;
+	int checked_index;
+	int request_start;         // 当前请求在缓冲区中的起始位置
+	CHECK_STATE checkstats;
+	http_request request;
+	struct iovec iv[CONN_MAX_IOV]; // 待发送的应答
+	int iv_count;
+	bool input_ready;          // socket上可能还有数据没有读（ET模式下读到EAGAIN之前）
+	bool closing;              // 发完应答后关闭连接
+	uint64_t requests;         // 处理的请求数
+};
+
+#endif
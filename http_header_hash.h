@@ -0,0 +1,195 @@
+#ifndef HTTP_HEADER_HASH
+#define HTTP_HEADER_HASH
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * 头部字段名到枚举值的完美哈希
+ * 已知的字段名在编译期算出一个乘数，使它们落在64个槽中互不冲突；
+ * 识别一个字段名只需要一遍：每次取8个字节，或上0x20转成小写（字段名只含字母、数字和'-'，
+ * 这几类字符或上0x20后只有大写字母会改变），同时算出哈希值，最后与槽中的名字按8字节比较一次
+ * 不在表中的名字返回HEADER_OTHER
+ */
+
+enum HTTP_HEADER
+{
+	HEADER_OTHER = 0,
+	HEADER_HOST,
+	HEADER_CONNECTION,
+	HEADER_CONTENT_LENGTH,
+	HEADER_CONTENT_TYPE,
+	HEADER_TRANSFER_ENCODING,
+	HEADER_IF_MODIFIED_SINCE,
+	HEADER_IF_NONE_MATCH,
+	HEADER_IF_RANGE,
+	HEADER_RANGE,
+	HEADER_EXPECT,
+	HEADER_KEEP_ALIVE,
+	HEADER_UPGRADE,
+	HEADER_USER_AGENT,
+	HEADER_ACCEPT,
+	HEADER_ACCEPT_ENCODING,
+	HEADER_ACCEPT_LANGUAGE,
+	HEADER_COOKIE,
+	HEADER_REFERER,
+	HEADER_COUNT
+};
+
+/* 下标与HTTP_HEADER一致，必须是小写 */
+static constexpr const char* http_header_names[HEADER_COUNT] = {
+	"",
+	"host",
+	"connection",
+	"content-length",
+	"content-type",
+	"transfer-encoding",
+	"if-modified-since",
+	"if-none-match",
+	"if-range",
+	"range",
+	"expect",
+	"keep-alive",
+	"upgrade",
+	"user-agent",
+	"accept",
+	"accept-encoding",
+	"accept-language",
+	"cookie",
+	"referer"
+};
+
+#define HEADER_HASH_BITS 6
+#define HEADER_HASH_SIZE (1 << HEADER_HASH_BITS)
+#define HEADER_NAME_MAX 24 // 已知字段名的最大长度（向上取整到8的倍数）
+
+namespace header_hash_detail
+{
+	constexpr uint64_t LOWER = 0x2020202020202020ULL;
+	constexpr uint64_t PRIME = 0x100000001b3ULL;
+
+	constexpr int length(const char* s)
+	{
+		int n = 0;
+		while (s[n]) ++n;
+		return n;
+	}
+
+	/* 编译期从字符串中按小端取出从i开始的至多8个字节 */
+	constexpr uint64_t word(const char* s, int len, int i)
+	{
+		uint64_t w = 0;
+		for (int k = 0; k < 8 && i + k < len; ++k)
+		{
+			w |= (uint64_t)(unsigned char)s[i + k] << (8 * k);
+		}
+		return w;
+	}
+
+	constexpr uint64_t mix(uint64_t h, uint64_t w)
+	{
+		return (h ^ w) * PRIME;
+	}
+
+	/* 编译期计算名字的哈希值，与运行期的header_hash逐位相同
+	   表中的名字已经是小写，或上0x20不改变它们 */
+	constexpr uint64_t hash(const char* s)
+	{
+		int len = length(s);
+		uint64_t h = (uint64_t)len;
+		for (int i = 0; i < len; i += 8)
+		{
+			h = mix(h, word(s, len, i));
+		}
+		return h;
+	}
+
+	constexpr int slot(uint64_t h, uint64_t multiplier)
+	{
+		return (int)((h * multiplier) >> (64 - HEADER_HASH_BITS));
+	}
+
+	/* 找一个使所有已知名字互不冲突的乘数 */
+	constexpr uint64_t find_multiplier()
+	{
+		uint64_t m = 0x9e3779b97f4a7c15ULL;
+		for (;;)
+		{
+			bool used[HEADER_HASH_SIZE] = {};
+			bool ok = true;
+			for (int id = 1; id < HEADER_COUNT && ok; ++id)
+			{
+				int s = slot(hash(http_header_names[id]), m);
+				if (used[s]) ok = false;
+				used[s] = true;
+			}
+			if (ok) return m;
+			m += 0x632be59bd9b4e019ULL * 2;
+		}
+	}
+
+	struct table
+	{
+		unsigned char ids[HEADER_HASH_SIZE]; // 槽 -> HTTP_HEADER
+		unsigned char lens[HEADER_COUNT];
+		uint64_t words[HEADER_COUNT][HEADER_NAME_MAX / 8]; // 小写的名字，按8字节存放，多余的字节为0
+	};
+
+	constexpr table build(uint64_t multiplier)
+	{
+		table t = {};
+		for (int id = 1; id < HEADER_COUNT; ++id)
+		{
+			const char* name = http_header_names[id];
+			int len = length(name);
+			t.ids[slot(hash(name), multiplier)] = (unsigned char)id;
+			t.lens[id] = (unsigned char)len;
+			for (int i = 0; i < len; i += 8)
+			{
+				t.words[id][i / 8] = word(name, len, i);
+			}
+		}
+		return t;
+	}
+
+	constexpr uint64_t MULTIPLIER = find_multiplier();
+	constexpr table TABLE = build(MULTIPLIER);
+
+	/* 运行期从name中取出从i开始的至多8个字节并转成小写，超出len的部分为0 */
+	inline uint64_t load_lower(const char* name, int len, int i)
+	{
+		uint64_t w = 0;
+		int n = len - i < 8 ? len - i : 8;
+		memcpy(&w, name + i, n);
+		/* 只对有效的字节或上0x20，补齐的0保持为0 */
+		uint64_t mask = n == 8 ? ~0ULL : (1ULL << (8 * n)) - 1;
+		return w | (LOWER & mask);
+	}
+}
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "header hash assumes little endian loads");
+
+/* 识别字段名（不要求以0结尾），忽略大小写 */
+inline HTTP_HEADER header_hash(const char* name, int len)
+{
+	using namespace header_hash_detail;
+	if (len <= 0 || len > HEADER_NAME_MAX) return HEADER_OTHER;
+	uint64_t words[HEADER_NAME_MAX / 8];
+	uint64_t h = (uint64_t)len;
+	int n = 0;
+	for (int i = 0; i < len; i += 8)
+	{
+		words[n] = load_lower(name, len, i);
+		h = mix(h, words[n]);
+		++n;
+	}
+	int id = TABLE.ids[slot(h, MULTIPLIER)];
+	if (id == HEADER_OTHER || TABLE.lens[id] != len) return HEADER_OTHER;
+	for (int i = 0; i < n; ++i)
+	{
+		if (words[i] != TABLE.words[id][i]) return HEADER_OTHER;
+	}
+	return (HTTP_HEADER)id;
+}
+
+#endif
@@ -0,0 +1,567 @@
+#ifndef HTTP_PARSER
+#define HTTP_PARSER
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <string_view>
+#include "crlf_scan.h"
+#include "http_header_hash.h"
+
+/**
+ * HTTP请求解析器（主从状态机）
+ * parse_line从缓冲区中分出行，parse_content按CHECK_STATE分析请求行、头部和消息体
+ * 解析器不做I/O，也不分配内存：结果以切片的形式保存在http_request中，消息体逐段交给body_cb
+ * 调用者负责读入数据，维护checked_index、read_index、start_line几个下标，
+ * 一个请求结束后重置这些状态再解析下一个请求（见8-3.cpp的serve_connection）
+ */
+
+#define MAX_HEADERS 32 /* 一个请求最多的头部个数 */
+
+/* 主机状态 */
+enum CHECK_STATE
+{
+	CHECK_STATE_REQUESTLINE = 0, // 正在分析请求行
+	CHECK_STATE_HEADER,          // 正在分析头部字段
+	CHECK_STATE_CONTENT          // 正在分析消息体
+};
+
+/* 消息体的长度由什么决定 */
+enum BODY_MODE
+{
+	BODY_NONE = 0, // 没有消息体
+	BODY_LENGTH,   // Content-Length
+	BODY_CHUNKED   // Transfer-Encoding: chunked
+};
+
+/* chunked编码的解析状态 */
+enum CHUNK_STATE
+{
+	CHUNK_SIZE = 0, // 正在分析块大小行
+	CHUNK_DATA,     // 正在读取块数据
+	CHUNK_DATA_END, // 块数据后面的\r\n
+	CHUNK_TRAILER   // 最后一块之后的尾部字段，直到空行
+};
+
+/* 状态机的三种可能状态 */
+enum LINE_STATUS
+{
+	LINE_OK = 0, // 完整行
+	LINE_BAD,    // 行出错
+	LINE_OPEN    // 尚不完整
+};
+
+/* HTTP请求结果 */
+enum HTTP_CODE
+{
+	NO_REQUEST,        // 请求不完整，需要继续读取
+	GET_REQUEST,       // 获得了一个完整的请求结果
+	BAD_REQUEST,       // 请求语法错误
+	FORBIDDEN_REQUEST, // 客户权限不够
+	INTERNAL_ERROR,    // 服务器内部错误
+	CLOSED_CONNECTION  // 客户端已经关闭链接
+};
+
+/**
+ * 解析出的请求，所有字段都是指向接收缓冲区的切片，解析过程不复制也不分配内存
+ * 切片在缓冲区被复用（读入下一个请求）之前有效
+ */
+struct http_header
+{
+	HTTP_HEADER id; // 已知的字段，其他为HEADER_OTHER
+	std::string_view name;
+	std::string_view value;
+};
+
+struct http_request;
+
+/* 消息体的处理函数，消息体到达一段就调用一次，data指向接收缓冲区，调用返回后不再有效 */
+typedef void (*body_handler)(http_request* request, const char* data, int len);
+
+struct http_request
+{
+	std::string_view method;
+	std::string_view url;
+	std::string_view version;
+	http_header headers[MAX_HEADERS];
+	int header_count;
+	unsigned char known[HEADER_COUNT]; // 已知字段第一次出现的位置+1，0表示没有
+
+	/* 消息体，不缓存，逐段交给body_cb */
+	BODY_MODE body_mode;
+	CHUNK_STATE chunk_state;
+	uint64_t body_remaining;  // Content-Length或者当前块还没读到的字节数
+	uint64_t body_received;   // 已经收到的消息体字节数
+	int body_offset;          // 消息体在缓冲区中的起始位置，之前是请求行和头部
+	body_handler body_cb;
+	void* user_data;
+
+	http_request(): body_cb(NULL), user_data(NULL)
+	{
+		reset();
+	}
+
+	/* 开始解析下一个请求前清空，消息体的处理函数保留 */
+	void reset()
+	{
+		method = url = version = std::string_view();
+		header_count = 0;
+		memset(known, 0, sizeof(known));
+		body_mode = BODY_NONE;
+		chunk_state = CHUNK_SIZE;
+		body_remaining = body_received = 0;
+		body_offset = 0;
+	}
+
+	/* 追加一个头部，已知字段同时记下位置 */
+	void add_header(HTTP_HEADER id, std::string_view name, std::string_view value)
+	{
+		http_header& header = headers[header_count++];
+		header.id = id;
+		header.name = name;
+		header.value = value;
+		if (id != HEADER_OTHER && !known[id]) known[id] = (unsigned char)header_count;
+	}
+
+	/* 取已知的字段，没有则返回NULL */
+	const http_header* get(HTTP_HEADER id) const
+	{
+		return known[id] ? &headers[known[id] - 1] : NULL;
+	}
+
+	/* 请求的数据从from搬到了to（缓冲区拼接或者换块）之后，让已有的切片跟着移动 */
+	void rebase(const char* from, const char* to)
+	{
+		method = rebase(method, from, to);
+		url = rebase(url, from, to);
+		version = rebase(version, from, to);
+		for (int i = 0; i < header_count; ++i)
+		{
+			headers[i].name = rebase(headers[i].name, from, to);
+			headers[i].value = rebase(headers[i].value, from, to);
+		}
+	}
+
+	/* 按名字查找头部（忽略大小写），没有则返回NULL；已知字段直接取，其他字段逐个比较 */
+	const http_header* find_header(const char* name) const
+	{
+		size_t len = strlen(name);
+		HTTP_HEADER id = header_hash(name, len);
+		if (id != HEADER_OTHER) return get(id);
+		for (int i = 0; i < header_count; ++i)
+		{
+			if (headers[i].name.size() == len && strncasecmp(headers[i].name.data(), name, len) == 0)
+			{
+				return &headers[i];
+			}
+		}
+		return NULL;
+	}
+
+private:
+	static std::string_view rebase(std::string_view slice, const char* from, const char* to)
+	{
+		return slice.data() ? std::string_view(to + (slice.data() - from), slice.size()) : slice;
+	}
+};
+
+/* 切片与字符串比较，忽略大小写 */
+static inline bool slice_equal(std::string_view slice, const char* str)
+{
+	size_t len = strlen(str);
+	return slice.size() == len && strncasecmp(slice.data(), str, len) == 0;
+}
+
+inline LINE_STATUS parse_line(char* buffer, int &checked_index, int &read_index)
+{
+	char temp;
+	/* checked_index指向目前buffer正在分析的字符
+	*  read_index指向buffer中客户端数据尾部的下一个字节
+	*  普通字符不需要处理，用crlf_scan一次跳过16~32个字节，直接定位到下一个\r或\n
+	*/
+	checked_index = crlf_scan(buffer + checked_index, buffer + read_index) - buffer;
+	if (checked_index >= read_index)
+	{
+		/* 如果内容分析完毕也没有遇到\r字符，表示还需要读取才能进一步分析 */
+		return LINE_OPEN;
+	}
+	temp = buffer[ checked_index ];
+	if (temp == '\r') // 可能读到一个完整的行
+	{
+		if ((checked_index + 1) == read_index) // \r是最后一个被读入的数据，那么需要继续读取才能进一步分析
+		{
+			return LINE_OPEN;
+		}
+		else if (buffer[checked_index + 1] == '\n') // 说明读到一个完整的行
+		{
+			buffer[checked_index++] = '\0';
+			buffer[checked_index++] = '\0';
+			return LINE_OK;
+		}
+		return LINE_BAD; // 请求语法错误
+	}
+	/* 也可能是完整的行 */
+	if ((checked_index > 1) && buffer[checked_index - 1] == '\r')
+	{
+		buffer[checked_index - 1] = '\0';
+		buffer[checked_index++] = '\0';
+		return LINE_OK;
+	}
+	return LINE_BAD; // \r\n 应该成对出现
+}
+
+
+/* 跳过空白符和\t */
+static inline const char* skip_space(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t')) ++p;
+	return p;
+}
+
+/* 找到第一个空白符或\t，没有则返回end */
+static inline const char* find_space(const char* p, const char* end)
+{
+	while (p < end && *p != ' ' && *p != '\t') ++p;
+	return p;
+}
+
+/**
+ * 解析 GET /search HTTP/1.1 的请求行
+ * @param  temp       请求行的起始位置
+ * @param  len        请求行的长度（不含\r\n）
+ * @param  checkstats 解析状态
+ * @param  request    解析出的方法、URL和版本以切片的形式保存在这里
+ * @return            解析结果
+ */
+inline HTTP_CODE parse_requestline(const char* temp, int len, CHECK_STATE &checkstats, http_request &request)
+{
+	const char* end = temp + len;
+	/* 找到temp第一个空白符或者\t所在的位置，请求行没有空白或'\t'，请求一定有问题 */
+	const char* url = find_space(temp, end);
+	if (url == end)
+	{
+		return BAD_REQUEST;
+	}
+	request.method = std::string_view(temp, url - temp);
+	/* 比较时忽略大小写，支持GET和带消息体的POST、PUT */
+	if (!slice_equal(request.method, "GET") && !slice_equal(request.method, "POST") && !slice_equal(request.method, "PUT"))
+	{
+		return BAD_REQUEST;
+	}
+
+	url = skip_space(url, end);
+	const char* version = find_space(url, end);
+	if (version == end)
+	{
+		return BAD_REQUEST;
+	}
+	const char* url_end = version;
+	version = skip_space(version, end);
+	request.version = std::string_view(version, end - version);
+	/* 支持HTTP/1.1和HTTP/1.0 */
+	if (!slice_equal(request.version, "HTTP/1.1") && !slice_equal(request.version, "HTTP/1.0"))
+	{
+		return BAD_REQUEST;
+	}
+	/* 绝对URI只保留路径部分 */
+	if (url_end - url >= 7 && strncasecmp(url, "http://", 7) == 0)
+	{
+		url = (const char*)memchr(url + 7, '/', url_end - url - 7);
+	}
+
+	if (!url || url == url_end || url[0] != '/')
+	{
+		return BAD_REQUEST;
+	}
+	request.url = std::string_view(url, url_end - url);
+	checkstats = CHECK_STATE_HEADER;
+	return NO_REQUEST;
+}
+
+/**
+ * 分析头部字段比如下面之类的
+ * Accept: 、Referer: 、Accept-Language: 、Accept-Encoding: 、User-Agent: 、 Host: 
+ * 字段名和去掉首尾空白的字段值以切片的形式追加到request的头部表中
+ */
+inline HTTP_CODE parse_headers(const char* temp, int len, http_request &request)
+{
+	/* 遇到空行，说明头部已经结束，HTTP请求正确 */
+	if (len == 0)
+	{
+		return GET_REQUEST;
+	}
+	const char* end = temp + len;
+	const char* colon = (const char*)memchr(temp, ':', len);
+	/* 没有冒号、字段名为空或者字段名后面有空白都是错误的头部 */
+	if (!colon || colon == temp || colon[-1] == ' ' || colon[-1] == '\t')
+	{
+		return BAD_REQUEST;
+	}
+	if (request.header_count >= MAX_HEADERS) // 头部太多
+	{
+		return BAD_REQUEST;
+	}
+	const char* value = skip_space(colon + 1, end);
+	while (end > value && (end[-1] == ' ' || end[-1] == '\t')) --end;
+	/* 字段名一遍哈希就能识别，不需要逐个strncasecmp */
+	request.add_header(header_hash(temp, colon - temp), std::string_view(temp, colon - temp), std::string_view(value, end - value));
+	return NO_REQUEST;
+}
+
+/* 解析十进制的Content-Length，格式错误或者溢出时返回false */
+inline bool parse_length(std::string_view value, uint64_t &length)
+{
+	if (value.empty()) return false;
+	length = 0;
+	for (size_t i = 0; i < value.size(); ++i)
+	{
+		char c = value[i];
+		if (c < '0' || c > '9' || length > (UINT64_MAX - 9) / 10) return false;
+		length = length * 10 + (c - '0');
+	}
+	return true;
+}
+
+/* 解析块大小行：十六进制的大小，后面可能有;开始的扩展，忽略扩展 */
+inline bool parse_chunk_size(const char* temp, int len, uint64_t &size)
+{
+	int i = 0;
+	size = 0;
+	for (; i < len; ++i)
+	{
+		char c = temp[i];
+		int digit;
+		if (c >= '0' && c <= '9') digit = c - '0';
+		else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') digit = (c | 0x20) - 'a' + 10;
+		else break;
+		if (size >> 60) return false; // 溢出
+		size = size * 16 + digit;
+	}
+	if (i == 0) return false;
+	while (i < len && (temp[i] == ' ' || temp[i] == '\t')) ++i;
+	return i == len || temp[i] == ';';
+}
+
+/**
+ * 头部结束后，根据Transfer-Encoding和Content-Length决定是否有消息体
+ * 有消息体时进入CHECK_STATE_CONTENT，返回NO_REQUEST；没有时返回GET_REQUEST
+ * 两者同时出现，或者多个Content-Length的值不同时，前后的代理可能对消息体的边界理解不一致（请求走私），
+ * 返回BAD_REQUEST
+ */
+inline HTTP_CODE parse_body_mode(CHECK_STATE &checkstats, int checked_index, http_request &request)
+{
+	const http_header* te = request.get(HEADER_TRANSFER_ENCODING);
+	const http_header* cl = request.get(HEADER_CONTENT_LENGTH);
+	if (te && cl)
+	{
+		return BAD_REQUEST;
+	}
+	if (te)
+	{
+		/* 只支持chunked；多个Transfer-Encoding合起来的编码不一定以chunked结尾，与Content-Length一样只接受一个 */
+		if (!slice_equal(te->value, "chunked"))
+		{
+			return BAD_REQUEST;
+		}
+		for (int i = te - request.headers + 1; i < request.header_count; ++i)
+		{
+			if (request.headers[i].id == HEADER_TRANSFER_ENCODING) return BAD_REQUEST;
+		}
+		request.body_mode = BODY_CHUNKED;
+		request.chunk_state = CHUNK_SIZE;
+	}
+	else if (cl)
+	{
+		if (!parse_length(cl->value, request.body_remaining))
+		{
+			return BAD_REQUEST;
+		}
+		/* 重复的Content-Length只有值都相同时才接受 */
+		for (int i = cl - request.headers + 1; i < request.header_count; ++i)
+		{
+			uint64_t length;
+			if (request.headers[i].id != HEADER_CONTENT_LENGTH) continue;
+			if (!parse_length(request.headers[i].value, length) || length != request.body_remaining)
+			{
+				return BAD_REQUEST;
+			}
+		}
+		if (request.body_remaining == 0)
+		{
+			return GET_REQUEST;
+		}
+		request.body_mode = BODY_LENGTH;
+	}
+	else
+	{
+		return GET_REQUEST;
+	}
+	request.body_offset = checked_index;
+	checkstats = CHECK_STATE_CONTENT;
+	return NO_REQUEST;
+}
+
+/**
+ * 分析消息体：数据部分直接交给body_cb，不需要等整个消息体到齐
+ * chunked编码的块大小行、块后的\r\n和尾部字段仍然按行分析
+ */
+inline HTTP_CODE parse_body(char* buffer, int &checked_index, int &read_index, int &start_line, http_request &request)
+{
+	while (true)
+	{
+		if (request.body_mode == BODY_LENGTH || request.chunk_state == CHUNK_DATA)
+		{
+			uint64_t avail = read_index - checked_index;
+			int n = (int)(avail < request.body_remaining ? avail : request.body_remaining);
+			if (n == 0)
+			{
+				return NO_REQUEST;
+			}
+			if (request.body_cb)
+			{
+				request.body_cb(&request, buffer + checked_index, n);
+			}
+			checked_index += n;
+			start_line = checked_index;
+			request.body_received += n;
+			request.body_remaining -= n;
+			if (request.body_remaining > 0)
+			{
+				return NO_REQUEST;
+			}
+			if (request.body_mode == BODY_LENGTH)
+			{
+				return GET_REQUEST;
+			}
+			request.chunk_state = CHUNK_DATA_END;
+			continue;
+		}
+
+		LINE_STATUS linestatus = parse_line(buffer, checked_index, read_index);
+		if (linestatus == LINE_OPEN)
+		{
+			return NO_REQUEST;
+		}
+		else if (linestatus == LINE_BAD)
+		{
+			return BAD_REQUEST;
+		}
+		char* temp = buffer + start_line;
+		int len = checked_index - 2 - start_line;
+		start_line = checked_index;
+		switch (request.chunk_state)
+		{
+			case CHUNK_SIZE:
+			{
+				if (!parse_chunk_size(temp, len, request.body_remaining))
+				{
+					return BAD_REQUEST;
+				}
+				/* 大小为0的块表示消息体结束，后面是尾部字段 */
+				request.chunk_state = request.body_remaining ? CHUNK_DATA : CHUNK_TRAILER;
+				break;
+			}
+			case CHUNK_DATA_END:
+			{
+				if (len != 0)
+				{
+					return BAD_REQUEST;
+				}
+				request.chunk_state = CHUNK_SIZE;
+				break;
+			}
+			case CHUNK_TRAILER:
+			{
+				/* 尾部字段暂时忽略，空行表示请求结束 */
+				if (len == 0)
+				{
+					return GET_REQUEST;
+				}
+				break;
+			}
+			default:
+			{
+				return INTERNAL_ERROR;
+			}
+		}
+	}
+}
+
+/* 分析HTTP请求入口函数，解析结果保存在request中，切片指向buffer */
+inline HTTP_CODE parse_content(char* buffer, int &checked_index, CHECK_STATE &checkstats, int &read_index, int &start_line, http_request &request)
+{
+	LINE_STATUS linestatus = LINE_OK; // 当前行读取状态
+	HTTP_CODE retcode = NO_REQUEST;   // 记录HTTP请求的处理结果
+	while (true)
+	{
+		if (checkstats == CHECK_STATE_CONTENT)
+		{
+			return parse_body(buffer, checked_index, read_index, start_line, request);
+		}
+		if ((linestatus = parse_line(buffer, checked_index, read_index)) != LINE_OK)
+		{
+			break;
+		}
+		char* temp = buffer + start_line;
+		int len = checked_index - 2 - start_line; // 去掉行尾的\r\n
+		start_line = checked_index;
+		switch (checkstats)
+		{
+			case CHECK_STATE_REQUESTLINE:
+			{
+				retcode = parse_requestline(temp, len, checkstats, request);
+				if (retcode == BAD_REQUEST)
+				{
+					return BAD_REQUEST;
+				}
+				break;
+			}
+			case CHECK_STATE_HEADER:
+			{
+				retcode = parse_headers(temp, len, request);
+				if (retcode == BAD_REQUEST)
+				{
+					return BAD_REQUEST;
+				}
+				else if (retcode == GET_REQUEST)
+				{
+					/* 头部结束，没有消息体时请求完整，否则接着分析消息体 */
+					retcode = parse_body_mode(checkstats, checked_index, request);
+					if (retcode != NO_REQUEST)
+					{
+						return retcode;
+					}
+				}
+				break;
+			}
+			default:
+			{
+				return INTERNAL_ERROR;
+			}
+		}
+	}
+	if (linestatus == LINE_OPEN)
+	{
+		return NO_REQUEST;
+	}
+	else
+	{
+		return BAD_REQUEST;
+	}
+}
+
+/**
+ * 请求处理完后连接是否保持
+ * HTTP/1.1默认保持，除非Connection: close；HTTP/1.0默认关闭，除非Connection: keep-alive
+ */
+inline bool keep_alive(const http_request &request)
+{
+	const http_header* conn = request.get(HEADER_CONNECTION);
+	if (slice_equal(request.version, "HTTP/1.1"))
+	{
+		return !conn || !slice_equal(conn->value, "close");
+	}
+	return conn && slice_equal(conn->value, "keep-alive");
+}
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "http_parser.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * HTTP解析器基准测试
+ * 用法: http_parser_bench [seconds]
+ * 不经过socket，直接用内存中的语料驱动parse_content，每类语料至少运行seconds秒（默认0.5），
+ * 输出每秒请求数、每秒字节数和每字节的CPU周期数：
+ *   small_get   : 只有Host的小GET请求
+ *   browser     : 浏览器风格的请求，十几个头部，带较长的Cookie和User-Agent
+ *   pipelined   : 一次读到16个连续的小请求
+ *   post_length : 带Content-Length消息体的POST
+ *   post_chunked: chunked编码消息体的PUT
+ * 每次解析前都要把语料复制到工作缓冲区（解析器会改写行尾），复制的时间单独测出后扣除
+ * 另外对每份语料在每个字节处切成两次读入，检查解析结果与一次读入完全相同
+ * 编译时定义CRLF_SCAN_SCALAR可以和标量的行扫描比较
+ */
+
+struct corpus
+{
+	const char* name;
+	std::string data;
+	int requests; // 语料中的请求个数
+};
+
+/* 解析结果的摘要，用于比较分段读入和一次读入的结果 */
+struct parse_digest
+{
+	std::string text;
+	uint64_t body_hash;
+};
+
+static parse_digest* current_digest = NULL;
+
+void digest_body(http_request*, const char* data, int len)
+{
+	if (!current_digest) return;
+	uint64_t h = current_digest->body_hash;
+	for (int i = 0; i < len; ++i)
+	{
+		h = (h ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+	}
+	current_digest->body_hash = h;
+}
+
+void count_body(http_request*, const char*, int)
+{
+}
+
+static void append_slice(std::string& s, std::string_view v)
+{
+	s.append(v.data(), v.size());
+	s.push_back('|');
+}
+
+static void digest_request(parse_digest& d, const http_request& request)
+{
+	append_slice(d.text, request.method);
+	append_slice(d.text, request.url);
+	append_slice(d.text, request.version);
+	for (int i = 0; i < request.header_count; ++i)
+	{
+		d.text += std::to_string(request.headers[i].id);
+		append_slice(d.text, request.headers[i].name);
+		append_slice(d.text, request.headers[i].value);
+	}
+	d.text += std::to_string(request.body_received) + "|" + std::to_string(d.body_hash) + "\n";
+	d.body_hash = 0;
+}
+
+/**
+ * 把buf中的len字节按cuts给出的位置分几次“读入”，像serve_connection一样连续解析其中的请求
+ * 返回完整解析的请求个数，出错时返回-1；digest不为NULL时记录解析结果
+ */
+static int parse_stream(char* buf, int len, const int* cuts, int ncuts, http_request& request, parse_digest* digest)
+{
+	int read_index = 0;
+	int start_line = 0;
+	int checked_index = 0;
+	CHECK_STATE checkstats = CHECK_STATE_REQUESTLINE;
+	int count = 0;
+	request.reset();
+	for (int c = 0; c <= ncuts; ++c)
+	{
+		read_index = c < ncuts ? cuts[c] : len;
+		while (true)
+		{
+			HTTP_CODE result = parse_content(buf, checked_index, checkstats, read_index, start_line, request);
+			if (result == NO_REQUEST)
+			{
+				break;
+			}
+			else if (result != GET_REQUEST)
+			{
+				if (digest) digest->text += "BAD\n";
+				return -1;
+			}
+			if (digest) digest_request(*digest, request);
+			++count;
+			checkstats = CHECK_STATE_REQUESTLINE;
+			request.reset();
+			start_line = checked_index;
+		}
+	}
+	return count;
+}
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return now_ns();
+#endif
+}
+
+static std::string small_get(int i)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "GET /static/img%d.png HTTP/1.1\r\nHost: www.example.com\r\n\r\n", i);
+	return line;
+}
+
+static std::string browser_request()
+{
+	return
+		"GET /search?q=linux+server+programming&ie=utf-8 HTTP/1.1\r\n"
+		"Host: www.example.com\r\n"
+		"Connection: keep-alive\r\n"
+		"Cache-Control: max-age=0\r\n"
+		"Upgrade-Insecure-Requests: 1\r\n"
+		"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+		"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+		"Sec-Fetch-Site: same-origin\r\n"
+		"Sec-Fetch-Mode: navigate\r\n"
+		"Sec-Fetch-Dest: document\r\n"
+		"Referer: https://www.example.com/\r\n"
+		"Accept-Encoding: gzip, deflate, br\r\n"
+		"Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+		"Cookie: BAIDUID=2F3C1E6A9B1D4F7E8A0C2B4D6F8A0C2E:FG=1; PSTM=1700000000; BIDUPSID=2F3C1E6A9B1D4F7E8A0C2B4D6F8A0C2E; H_PS_PSSID=39999_40001_40010; BD_UPN=12314753\r\n"
+		"If-Modified-Since: Sat, 01 Jan 2022 00:00:00 GMT\r\n"
+		"\r\n";
+}
+
+static std::string post_length()
+{
+	std::string body(1024, 'a');
+	for (size_t i = 0; i < body.size(); ++i) body[i] = 'a' + i % 26;
+	return "POST /api/upload HTTP/1.1\r\nHost: api.example.com\r\nContent-Type: application/octet-stream\r\nContent-Length: "
+		+ std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+static std::string post_chunked()
+{
+	std::string msg = "PUT /api/stream HTTP/1.1\r\nHost: api.example.com\r\nTransfer-Encoding: chunked\r\n\r\n";
+	static const int sizes[] = {1, 15, 256, 700, 4};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		char line[32];
+		snprintf(line, sizeof(line), "%x;ext=%zu\r\n", sizes[i], i);
+		msg += line;
+		msg += std::string(sizes[i], 'c');
+		msg += "\r\n";
+	}
+	msg += "0\r\nX-Trailer: done\r\n\r\n";
+	return msg;
+}
+
+static void build_corpus(std::vector<corpus>& out)
+{
+	corpus c;
+	c.name = "small_get";
+	c.data = small_get(7);
+	c.requests = 1;
+	out.push_back(c);
+
+	c.name = "browser";
+	c.data = browser_request();
+	c.requests = 1;
+	out.push_back(c);
+
+	c.name = "pipelined";
+	c.data.clear();
+	for (int i = 0; i < 16; ++i) c.data += small_get(i);
+	c.requests = 16;
+	out.push_back(c);
+
+	c.name = "post_length";
+	c.data = post_length();
+	c.requests = 1;
+	out.push_back(c);
+
+	c.name = "post_chunked";
+	c.data = post_chunked();
+	c.requests = 1;
+	out.push_back(c);
+}
+
+static void bench(const corpus& c, double seconds)
+{
+	int len = (int)c.data.size();
+	std::vector<char> work(len);
+	http_request request;
+	request.body_cb = count_body;
+
+	/* 先单独测复制语料的时间 */
+	uint64_t iters = 0;
+	uint64_t copy_ns = 0, copy_cycles = 0;
+	{
+		uint64_t start = now_ns(), start_cycles = cycles();
+		for (int i = 0; i < 100000; ++i)
+		{
+			memcpy(&work[0], c.data.data(), len);
+			__asm__ __volatile__("" : : "r"(&work[0]) : "memory");
+		}
+		copy_ns = now_ns() - start;
+		copy_cycles = cycles() - start_cycles;
+	}
+
+	uint64_t start = now_ns(), start_cycles = cycles();
+	uint64_t deadline = start + (uint64_t)(seconds * 1e9);
+	int parsed = 0;
+	do
+	{
+		for (int i = 0; i < 1000; ++i)
+		{
+			memcpy(&work[0], c.data.data(), len);
+			parsed = parse_stream(&work[0], len, NULL, 0, request, NULL);
+		}
+		iters += 1000;
+	} while (now_ns() < deadline);
+	uint64_t ns = now_ns() - start;
+	uint64_t cyc = cycles() - start_cycles;
+	/* 扣除复制的开销 */
+	double per_iter_ns = (double)ns / iters - (double)copy_ns / 100000;
+	double per_iter_cycles = (double)cyc / iters - (double)copy_cycles / 100000;
+	if (per_iter_ns <= 0) per_iter_ns = 1e-3;
+
+	if (parsed != c.requests)
+	{
+		printf("%-14s parsed %d requests, expected %d\n", c.name, parsed, c.requests);
+	}
+	printf("%-14s %5d bytes %3d req  %12.0f req/s  %8.1f MB/s  %6.2f cycles/byte\n",
+		c.name, len, c.requests, c.requests * 1e9 / per_iter_ns, len * 1e3 / per_iter_ns,
+		per_iter_cycles / len);
+}
+
+/* 在每个字节处切成两次读入，与一次读入的结果比较，返回不一致的个数 */
+static int check_splits(const corpus& c)
+{
+	int len = (int)c.data.size();
+	std::vector<char> work(len);
+	http_request request;
+	request.body_cb = digest_body;
+
+	parse_digest whole;
+	whole.body_hash = 0;
+	current_digest = &whole;
+	memcpy(&work[0], c.data.data(), len);
+	int n = parse_stream(&work[0], len, NULL, 0, request, &whole);
+	int mismatches = 0;
+	if (n != c.requests)
+	{
+		printf("%-14s whole buffer parsed %d requests, expected %d\n", c.name, n, c.requests);
+		++mismatches;
+	}
+
+	for (int cut = 1; cut < len; ++cut)
+	{
+		parse_digest split;
+		split.body_hash = 0;
+		current_digest = &split;
+		memcpy(&work[0], c.data.data(), len);
+		parse_stream(&work[0], len, &cut, 1, request, &split);
+		if (split.text != whole.text)
+		{
+			if (mismatches < 5)
+			{
+				printf("%-14s split at %d differs:\n%s---\n%s", c.name, cut, whole.text.c_str(), split.text.c_str());
+			}
+			++mismatches;
+		}
+	}
+	current_digest = NULL;
+	printf("%-14s split check: %d cuts, %d mismatches\n", c.name, len - 1, mismatches);
+	return mismatches;
+}
+
+int main(int argc, char const *argv[])
+{
+	double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+	if (seconds <= 0) seconds = 0.5;
+	std::vector<corpus> corpora;
+	build_corpus(corpora);
+
+	printf("crlf_scan: %s\n", crlf_scan_name());
+	int mismatches = 0;
+	for (size_t i = 0; i < corpora.size(); ++i)
+	{
+		mismatches += check_splits(corpora[i]);
+	}
+	for (size_t i = 0; i < corpora.size(); ++i)
+	{
+		bench(corpora[i], seconds);
+	}
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,303 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "lst_timer.h"
+#include "http_conn.h"
+
+/**
+ * 多连接的HTTP服务器
+ * 用法: http_server ip port
+ * 8-3.cpp的解析器放进每个连接一个的http_conn对象中，由一个非阻塞、ET模式的epoll循环驱动（同9-3.cpp），
+ * 一个进程可以同时服务大量的持久连接和流水线请求
+ * 空闲超时使用lst_timer.h的升序链表（惰性模式，见lst_timer_test.cpp）：收到数据只记录活动时间，
+ * 定时器到期时再按最后活动时间决定关闭还是延长；定时器由timerfd按最早的到期时间唤醒
+ * kill -USR1 打印连接数和定时器统计，kill -TERM 退出
+ */
+
+#define MAX_FD 65536
+#define MAX_EVENT_NUMBER 1024
+#define IDLE_TIMEOUT 15000 /* 连接空闲超时，毫秒 */
+#define EXPIRE_BUDGET 256 /* 每次tick最多关闭的连接数，其余留到下一轮事件循环 */
+
+static int pipefd[2];
+/* 到期时间以CLOCK_MONOTONIC的毫秒为单位，不受系统时间调整的影响 */
+static sort_timer_lst timer_lst(real_clock::monotonic(), 1);
+static int epollfd = 0;
+static int timerfd = -1;
+static time_t armed_expire_ms = -1; /* timerfd当前设定的到期时间（毫秒），-1表示未设定 */
+static http_conn** conns = NULL;    /* 以fd为下标，第一次使用某个fd时创建，之后复用 */
+static client_data* users = NULL;   /* 定时器的用户数据，以fd为下标 */
+static int user_count = 0;
+
+int setnonblocking(int fd)
+{
+	int old_opt = fcntl(fd, F_GETFL);
+	int new_opt = old_opt | O_NONBLOCK;
+	fcntl(fd, F_SETFL, new_opt);
+	return old_opt;
+}
+
+void addfd(int epollfd, int fd, uint32_t events)
+{
+	epoll_event event;
+	event.data.fd = fd;
+	event.events = events | EPOLLET;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+	setnonblocking(fd);
+}
+
+void sig_handler(int sig)
+{
+	int save_errno = errno;
+	int msg = sig;
+	send(pipefd[1], (char*)&msg, 1, 0);
+	errno = save_errno;
+}
+
+void addsig(int sig)
+{
+	struct sigaction sa;
+	memset(&sa, '\0', sizeof(sa));
+	sa.sa_handler = sig_handler;
+	sa.sa_flags |= SA_RESTART;
+	sigfillset(&sa.sa_mask);
+	assert(sigaction(sig, &sa, NULL) != -1);
+}
+
+/* 把timerfd设定为定时器链表中最早的到期时间（绝对时间），链表为空时关闭timerfd */
+void rearm_timer()
+{
+	time_t expire_ms = timer_lst.next_expiry();
+	if (expire_ms == armed_expire_ms) return;
+	struct itimerspec its;
+	memset(&its, '\0', sizeof(its));
+	if (expire_ms >= 0) // it_value全0表示关闭
+	{
+		its.it_value.tv_sec = expire_ms / 1000;
+		its.it_value.tv_nsec = (expire_ms % 1000) * 1000000;
+	}
+	int ret = timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+	assert(ret != -1);
+	armed_expire_ms = expire_ms;
+}
+
+/* 关闭连接，不处理定时器 */
+void close_conn(int sockfd)
+{
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, sockfd, 0);
+	conns[sockfd]->close_conn();
+	--user_count;
+}
+
+/* 空闲超时的回调，定时器节点由链表回收 */
+void cb_func(client_data* user_data)
+{
+	assert(user_data);
+	user_data->timer = NULL;
+	close_conn(user_data->sockfd);
+}
+
+/* 连接出错或者处理完毕时关闭，并删除它的定时器 */
+void close_with_timer(int sockfd)
+{
+	util_timer* timer = users[sockfd].timer;
+	users[sockfd].timer = NULL;
+	if (timer) timer_lst.del_timer(timer);
+	close_conn(sockfd);
+}
+
+/* ET模式下循环accept，直到没有新连接 */
+void accept_all(int listenfd, time_t now)
+{
+	while (true)
+	{
+		struct sockaddr_in client_address;
+		socklen_t client_addrlength = sizeof(client_address);
+		int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+		if (connfd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) printf("accept error: %d\n", errno);
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (connfd >= MAX_FD)
+		{
+			close(connfd);
+			continue;
+		}
+		/* 同时关注可读和可写，ET模式下可写事件只在发送缓冲区从满变为不满时触发一次 */
+		addfd(epollfd, connfd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+		if (!conns[connfd]) conns[connfd] = new http_conn;
+		conns[connfd]->init(connfd, client_address);
+		++user_count;
+
+		users[connfd].address = client_address;
+		users[connfd].sockfd = connfd;
+		users[connfd].last_active = now;
+		util_timer* timer = timer_pool<util_timer>::create();
+		timer->user_data = &users[connfd];
+		timer->cb_func = cb_func;
+		timer->expire = now + IDLE_TIMEOUT;
+		timer->timeout = IDLE_TIMEOUT; // 惰性模式
+		users[connfd].timer = timer;
+		timer_lst.add_timer(timer);
+	}
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc <= 2)
+	{
+		printf("usage: %s ip port\n", basename((char*)argv[0]));
+		return 1;
+	}
+	const char* ip = argv[1];
+	int port = atoi(argv[2]);
+
+	int ret = 0;
+	struct sockaddr_in address;
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	inet_pton(AF_INET, ip, &address.sin_addr);
+	address.sin_port = htons(port);
+
+	int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+	assert(listenfd >= 0);
+	int reuse = 1;
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
+	assert(ret != -1);
+	ret = listen(listenfd, SOMAXCONN);
+	assert(ret != -1);
+
+	/* 对方已经关闭时写socket会产生SIGPIPE，忽略它，由writev返回EPIPE */
+	signal(SIGPIPE, SIG_IGN);
+
+	epoll_event events[MAX_EVENT_NUMBER];
+	epollfd = epoll_create(5);
+	assert(epollfd != -1);
+	addfd(epollfd, listenfd, EPOLLIN);
+
+	ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
+	assert(ret != -1);
+	setnonblocking(pipefd[1]);
+	addfd(epollfd, pipefd[0], EPOLLIN);
+
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	assert(timerfd != -1);
+	addfd(epollfd, timerfd, EPOLLIN);
+
+	addsig(SIGTERM);
+	addsig(SIGUSR1);
+	bool stop_server = false;
+	conns = new http_conn*[MAX_FD]();
+	users = new client_data[MAX_FD];
+	timer_pool<util_timer>::local().reserve(MAX_EVENT_NUMBER);
+	timer_lst.set_budget(EXPIRE_BUDGET, 0);
+
+	while (!stop_server)
+	{
+		bool timeout = false;
+		int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, timer_lst.has_pending() ? 0 : -1);
+		if ((number < 0) && (errno != EINTR))
+		{
+			printf("epoll failure\n");
+			break;
+		}
+		time_t now = real_clock::monotonic()->now_ms(); // 本轮事件共用的当前时间（毫秒）
+
+		for (int i = 0; i < number; ++i)
+		{
+			int sockfd = events[i].data.fd;
+			uint32_t ev = events[i].events;
+			if (sockfd == listenfd)
+			{
+				accept_all(listenfd, now);
+			}
+			else if (sockfd == timerfd)
+			{
+				uint64_t expirations;
+				read(timerfd, &expirations, sizeof(expirations));
+				armed_expire_ms = -1; // 绝对时间的单次定时已经触发
+				timeout = true;
+			}
+			else if (sockfd == pipefd[0])
+			{
+				char signals[1024];
+				ret = recv(pipefd[0], signals, sizeof(signals), 0);
+				for (int k = 0; k < ret; ++k)
+				{
+					if (signals[k] == SIGTERM)
+					{
+						stop_server = true;
+					}
+					else if (signals[k] == SIGUSR1)
+					{
+						printf("%d connections\n", user_count);
+						timer_lst.get_stats().dump(stdout, "timer_lst");
+					}
+				}
+			}
+			else if (conns[sockfd] && conns[sockfd]->fd() >= 0)
+			{
+				/* 同一轮中连接可能已经被前面的事件关闭 */
+				CONN_STATUS status;
+				if (ev & (EPOLLHUP | EPOLLERR))
+				{
+					status = CONN_CLOSE;
+				}
+				else
+				{
+					status = CONN_READ;
+					if (ev & (EPOLLIN | EPOLLRDHUP))
+					{
+						users[sockfd].last_active = now; // 只记录活动时间，定时器到期时再决定是否延长
+						status = conns[sockfd]->on_readable();
+					}
+					else if (ev & EPOLLOUT)
+					{
+						status = conns[sockfd]->on_writable();
+					}
+				}
+				if (status == CONN_CLOSE)
+				{
+					close_with_timer(sockfd);
+				}
+			}
+		}
+		if (timeout || timer_lst.has_pending())
+		{
+			timer_lst.tick();
+		}
+		/* 本轮的添加、删除和到期都可能改变最早的到期时间 */
+		rearm_timer();
+	}
+
+	for (int fd = 0; fd < MAX_FD; ++fd)
+	{
+		if (!conns[fd]) continue;
+		if (conns[fd]->fd() >= 0) close_with_timer(fd);
+		delete conns[fd];
+	}
+	close(listenfd);
+	close(timerfd);
+	close(pipefd[1]);
+	close(pipefd[0]);
+	close(epollfd);
+	timer_lst.get_stats().dump(stdout, "timer_lst");
+	delete [] users;
+	delete [] conns;
+	return 0;
+}
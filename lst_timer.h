@@ -2,8 +2,31 @@
 #define LST_TIMER
 
 #include <time.h>
+#include "timer_pool.h"
+#include "timer_clock.h"
+#include "timer_stats.h"
+#include "timer_batch.h"
+
+/* 定义TIMER_DEBUG后打印定时器的调试信息 */
+#ifndef TIMER_TRACE
+#ifdef TIMER_DEBUG
+#define TIMER_TRACE(...) printf(__VA_ARGS__)
+#else
+#define TIMER_TRACE(...)
+#endif
+#endif
 #define BUFFER_SIZE 64
-class util_timer;
+
+/**
+ * 定时器节点以负载类型T和回调类型Callback为模板参数
+ * 默认的util_timer与原来一致：回调是void(*)(client_data*)函数指针
+ * Callback也可以是带状态的函数对象（需要可默认构造），直接存放在节点里，
+ * 到期时cb_func(user_data)可以被内联，不需要额外的堆分配或者旁路表
+ */
+struct client_data;
+template<typename T = client_data, typename Callback = void (*)(T*)>
+class basic_util_timer;
+typedef basic_util_timer<> util_timer;
 
 struct client_data
 {
@@ -11,64 +34,81 @@ struct client_data
 	int sockfd;
 	char buf[BUFFER_SIZE];
 	util_timer* timer;
+	time_t last_active; /* 最近一次收到数据的时间，惰性定时器到期时据此判断是否真的空闲 */
 };
 
-class util_timer
+/* 惰性定时器读取负载的最近活动时间；没有last_active的负载类型返回0，即不支持惰性模式 */
+template<typename T>
+inline time_t timer_last_active(const T* user_data)
+{
+	return 0;
+}
+inline time_t timer_last_active(const client_data* user_data)
+{
+	return user_data->last_active;
+}
+
+template<typename T, typename Callback>
+class basic_util_timer
 {
 public:
-	util_timer():prev(NULL), next(NULL){}
+	typedef T data_type;
+	basic_util_timer():timeout(0), heap_index(-1), pending(false), cb_func(), user_data(NULL), prev(NULL), next(NULL){}
 public:
 	time_t expire; /* 任务超时时间，绝对时间 */
-	void(*cb_func)(client_data*); /* 回调函数 */
-	client_data* user_data;
-	util_timer* prev;
-	util_timer* next;
+	/* 惰性模式下的空闲超时（与expire单位相同），0表示普通定时器。惰性定时器的连接有数据时只更新
+	   user_data->last_active，到期时若仍未空闲满timeout，则按剩余时间重新排队而不执行回调 */
+	time_t timeout;
+	int heap_index; /* 在time_heap中的下标，-1表示不在堆中 */
+	bool pending;   /* 已经到期，在待执行队列中等待回调 */
+	Callback cb_func; /* 回调函数 */
+	T* user_data;
+	basic_util_timer* prev;
+	basic_util_timer* next;
 };
 
 /* 定时器链表，升序、双向、带有头节点和尾节点 */
 /* 添加定时器O(n)，删除O(1)，执行O(1) */
-class sort_timer_lst
+template<typename Timer = util_timer>
+class basic_sort_timer_lst
 {
 public:
-	sort_timer_lst():head(NULL), tail(NULL) {}
-	~sort_timer_lst()
+	/* clock为NULL时使用墙上时间，与调用者用time(NULL)计算的expire一致
+	   unit_ms是expire（以及timeout、last_active）的单位换算成毫秒的倍数，默认1000即秒；传1时以毫秒为单位 */
+	basic_sort_timer_lst(timer_clock* clk = NULL, uint64_t unit_ms = 1000):head(NULL), tail(NULL),
+		clock(clk ? clk : real_clock::wall()), unit(unit_ms ? unit_ms : 1) {}
+	~basic_sort_timer_lst()
 	{
-		util_timer* tmp = head;
+		Timer* tmp = head;
 		while(tmp)
 		{
 			head = tmp->next;
-			delete tmp;
+			timer_pool<Timer>::destroy(tmp);
 			tmp = head;
 		}
+		expired.clear(release);
 	}
 
 	/* 添加一个定时器到链表中 */
-	void add_timer(util_timer* timer)
+	void add_timer(Timer* timer)
 	{
 		if (!timer) return;
-		if (!head)
-		{
-			head = tail = timer;
-			return;
-		}
-		/* 将定时器插入到合适的位置 */
-		if (timer->expire < head->expire)
-		{
-			/* 小于链表中所有，插入到头 */
-			timer->next = head;
-			head->prev = timer;
-			head = timer;
-			return;
-		}
-		/* 在链表中寻找合适的位置插入 */
-		add_timer(timer, head);
+		stats.on_add();
+		insert_timer(timer);
 	}
 
 	/* 调整一个定时器在链表中的位置，这里只考虑了时间延长的情况，即向表尾调整 */
-	void adjust_timer(util_timer* timer)
+	void adjust_timer(Timer* timer)
 	{
 		if (!timer) return;
-		util_timer* tmp = timer->next;
+		if (timer->pending)
+		{
+			/* 已经到期但回调还没执行，放回链表 */
+			expired.remove(timer);
+			insert_timer(timer);
+			return;
+		}
+		Timer* tmp = timer->next;
 		/* 如果是在表尾 或者 调整后也比后一个时间小 则直接返回 */
 		if (!tmp || (timer->expire < tmp->expire)) return;
 		/* 如果被调整的是头部，取出后重新插入 */
@@ -87,13 +127,20 @@ public:
 		}
 	}
 
-	void del_timer(util_timer* timer)
+	void del_timer(Timer* timer)
 	{
 		if (!timer) return;
+		stats.on_del();
+		if (timer->pending)
+		{
+			expired.remove(timer);
+			timer_pool<Timer>::destroy(timer);
+			return;
+		}
 		/* 只有一个定时器 */
 		if ((timer == head) && (timer == tail))
 		{
-			delete timer;
+			timer_pool<Timer>::destroy(timer);
 			head = NULL;
 			tail = NULL;
 			return;
@@ -102,46 +149,111 @@ public:
 		{
 			head = head->next;
 			head->prev = NULL;
-			delete timer;
+			timer_pool<Timer>::destroy(timer);
 			return;
 		}
 		if (timer == tail)
 		{
 			tail = tail->prev;
 			tail->next = NULL;
-			delete timer;
+			timer_pool<Timer>::destroy(timer);
 			return;
 		}
 		timer->prev->next = timer->next;
 		timer->next->prev = timer->prev;
-		delete timer;
+		timer_pool<Timer>::destroy(timer);
+	}
+
+	/* 最早到期的时间，链表为空时返回-1，用于设置timerfd */
+	time_t next_expiry() const
+	{
+		return head ? head->expire : -1;
+	}
+
+	const timer_stats& get_stats() const { return stats; }
+
+	/* 设置每次tick执行回调的预算，0表示不限制 */
+	void set_budget(int max_count, uint64_t max_ns)
+	{
+		budget.max_count = max_count;
+		budget.max_ns = max_ns;
 	}
 
-	/* SIGALRM信号每次被触发就执行一次tick函数，用来处理链表上到期的任务 */
+	/* 是否还有已经到期、因为预算用完而没有执行的定时器，事件循环应尽快再次tick */
+	bool has_pending() const { return !expired.empty(); }
+
+	/* 定时事件到来时执行一次tick函数，用来处理链表上到期的任务 */
+	/* 先把到期的定时器全部移到待执行队列，再在预算内执行回调，剩下的留到下一次tick */
 	void tick()
 	{
-		if (!head) return;
-		printf("timer tick\n");
-		time_t cut = time(NULL); //系统当前时间
-		util_timer* tmp = head;
+		TIMER_TRACE("timer tick\n");
+		uint64_t now = clock->now_ms();
+		time_t cut = now / unit; //当前时间
+		Timer* tmp = head;
 		/* 从头带尾依次处理每一个到期的定时器 */
 		while (tmp)
 		{
 			if (cut < tmp->expire) break;
-			tmp->cb_func(tmp->user_data);
 			head = tmp->next;
 			if (head) head->prev = NULL;
-			delete tmp;
+			else tail = NULL;
+			tmp->prev = tmp->next = NULL;
+			if (tmp->timeout > 0 && cut < timer_last_active(tmp->user_data) + tmp->timeout)
+			{
+				/* 期间有过活动，按剩余的空闲时间重新插入 */
+				tmp->expire = timer_last_active(tmp->user_data) + tmp->timeout;
+				insert_timer(tmp);
+			}
+			else
+			{
+				expired.push(tmp);
+			}
 			tmp = head;
 		}
+		stats.on_tick(expired.dispatch(budget, now, unit, stats, release));
 	}
 
 private:
+	static void release(Timer* timer)
+	{
+		timer_pool<Timer>::destroy(timer);
+	}
+
+	/* 把定时器插入到链表中合适的位置，不计入统计 */
+	void insert_timer(Timer* timer)
+	{
+		if (!head)
+		{
+			head = tail = timer;
+			return;
+		}
+		/* 将定时器插入到合适的位置 */
+		if (timer->expire < head->expire)
+		{
+			/* 小于链表中所有，插入到头 */
+			timer->next = head;
+			head->prev = timer;
+			head = timer;
+			return;
+		}
+		if (timer->expire >= tail->expire)
+		{
+			/* 超时时间相同的空闲定时器总是越加越晚，直接接到表尾，不需要遍历链表 */
+			timer->prev = tail;
+			timer->next = NULL;
+			tail->next = timer;
+			tail = timer;
+			return;
+		}
+		/* 在链表中寻找合适的位置插入 */
+		add_timer(timer, head);
+	}
+
 	/* 重载辅助函数，用于在链表lst_head后插入一个新的节点 */
-	void add_timer(util_timer* timer, util_timer* lst_head)
+	void add_timer(Timer* timer, Timer* lst_head)
 	{
-		util_timer* prev = lst_head;
-		util_timer* tmp = prev->next;
+		Timer* prev = lst_head;
+		Timer* tmp = prev->next;
 		while(tmp)
 		{
 			if (timer->expire < tmp->expire)
@@ -149,7 +261,7 @@ private:
 				prev->next = timer;
 				timer->next = tmp;
 				timer->prev = prev;
-				tmp->prev = tmp;
+				tmp->prev = timer;
 				break;
 			}
 			prev = tmp;
@@ -165,8 +277,15 @@ private:
 	}
 
 private:
-	util_timer* head;
-	util_timer* tail;
+	Timer* head;
+	Timer* tail;
+	timer_clock* clock;
+	uint64_t unit;
+	timer_stats stats;
+	timer_batch<Timer> expired; // 已经到期、等待执行回调的定时器
+	timer_budget budget;
 };
 
+typedef basic_sort_timer_lst<> sort_timer_lst;
+
 #endif
\ No newline at end of file
@@ -11,16 +11,23 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <pthread.h>
+#define TIMER_DEBUG
 #include "lst_timer.h"
 
 #define FD_LIMIT 65535
 #define MAX_EVENT_NUMBER 1024
 #define TIMESLOT 5
+#define IDLE_TIMEOUT (3 * TIMESLOT * 1000) /* 连接空闲超时，毫秒 */
+#define EXPIRE_BUDGET 256 /* 每次tick最多关闭的连接数，其余留到下一轮事件循环 */
 
 static int pipefd[2];
-static sort_timer_lst timer_lst;
+/* 到期时间以CLOCK_MONOTONIC的毫秒为单位，不受系统时间调整的影响 */
+static sort_timer_lst timer_lst(real_clock::monotonic(), 1);
 static int epollfd = 0;
+static int timerfd = -1;
+static time_t armed_expire_ms = -1; /* timerfd当前设定的到期时间（毫秒），-1表示未设定 */
 
 int setnonblocking(int fd)
 {
@@ -57,10 +64,32 @@ void addsig(int sig)
 	assert(sigaction(sig, &sa, NULL) != -1);
 }
 
+/**
+ * 把timerfd设定为定时器链表中最早的到期时间（绝对时间），链表为空时关闭timerfd
+ * 到期时间没有变化时不做系统调用，没有定时器时也不会有任何唤醒
+ */
+void rearm_timer()
+{
+	time_t expire_ms = timer_lst.next_expiry();
+	if (expire_ms == armed_expire_ms) return;
+	struct itimerspec its;
+	memset(&its, '\0', sizeof(its));
+	if (expire_ms >= 0) // it_value全0表示关闭
+	{
+		its.it_value.tv_sec = expire_ms / 1000;
+		its.it_value.tv_nsec = (expire_ms % 1000) * 1000000;
+	}
+	int ret = timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+	assert(ret != -1);
+	armed_expire_ms = expire_ms;
+}
+
 void timer_handler()
 {
+	uint64_t expirations;
+	read(timerfd, &expirations, sizeof(expirations));
+	armed_expire_ms = -1; // 绝对时间的单次定时已经触发
 	timer_lst.tick();
-	alarm(TIMESLOT);
 }
 
 /* 定时器回调函数 */
@@ -102,7 +131,7 @@ int main(int argc, char const *argv[])
 	assert(ret != -1);
 
 	epoll_event events[MAX_EVENT_NUMBER];
-	int epollfd = epoll_create(5);
+	epollfd = epoll_create(5);
 	assert(epollfd != -1);
 	addfd(epollfd, listenfd);
 
@@ -111,21 +140,29 @@ int main(int argc, char const *argv[])
 	setnonblocking(pipefd[1]);
 	addfd(epollfd, pipefd[0]);
 
-	addsig(SIGALRM);
+	/* 定时器到期时间是CLOCK_MONOTONIC的绝对时间，与timer_lst使用的时钟一致 */
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	assert(timerfd != -1);
+	addfd(epollfd, timerfd);
+
 	addsig(SIGTERM);
+	addsig(SIGUSR1); /* kill -USR1 打印定时器统计 */
 	bool stop_server = false;
 	client_data* users = new client_data[FD_LIMIT];
-	bool timeout = false;
-	alarm(TIMESLOT); /* 定时 */
+	timer_pool<util_timer>::local().reserve(MAX_EVENT_NUMBER); /* 预分配定时器节点 */
+	timer_lst.set_budget(EXPIRE_BUDGET, 0);
 
 	while (!stop_server)
 	{
-		int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+		bool timeout = false;
+		/* 还有推迟执行的超时回调时不阻塞，处理完就绪的I/O后马上继续 */
+		int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, timer_lst.has_pending() ? 0 : -1);
 		if ((number < 0) && (errno != EINTR))
 		{
 			printf("epoll failure\n");
 			break;
 		}
+		time_t now = real_clock::monotonic()->now_ms(); // 本轮事件共用的当前时间（毫秒）
 
 		for (int i = 0; i < number; ++i)
 		{
@@ -138,14 +175,19 @@ int main(int argc, char const *argv[])
 				addfd(epollfd, connfd);
 				users[connfd].address = client_address;
 				users[connfd].sockfd = connfd;
-				util_timer* timer = new util_timer;
+				users[connfd].last_active = now;
+				util_timer* timer = timer_pool<util_timer>::create();
 				timer->user_data = &users[connfd];
 				timer->cb_func = cb_func;
-				time_t cur = time(NULL);
-				timer->expire = cur + 3 * TIMESLOT;
+				timer->expire = now + IDLE_TIMEOUT;
+				timer->timeout = IDLE_TIMEOUT; // 惰性模式
 				users[connfd].timer = timer;
 				timer_lst.add_timer(timer);
 			}
+			else if (sockfd == timerfd && (events[i].events & EPOLLIN))
+			{
+				timeout = true;
+			}
 			else if (sockfd == pipefd[0] && (events[i].events & EPOLLIN))
 			{
 				int sig;
@@ -159,14 +201,15 @@ int main(int argc, char const *argv[])
 					{
 						switch(signals[i])
 						{
-							case SIGALRM:
+							case SIGTERM:
 							{
-								timeout = true;
+								stop_server = true;
 								break;
 							}
-							case SIGTERM:
+							case SIGUSR1:
 							{
-								stop_server = true;
+								timer_lst.get_stats().dump(stdout, "timer_lst");
+								break;
 							}
 						}
 					}
@@ -192,15 +235,9 @@ int main(int argc, char const *argv[])
 					cb_func(&users[sockfd]);
 					if (timer) timer_lst.del_timer(timer);
 				}
-				else // 有数据可读，延长定时
+				else // 有数据可读，只记录活动时间，定时器到期时再决定是否延长
 				{
-					if (timer)
-					{
-						time_t cur = time(NULL);
-						timer->expire = cur + 3 * TIMESLOT;
-						printf("adjust timer once\n");
-						timer_lst.adjust_timer(timer);
-					}
+					users[sockfd].last_active = now;
 				}
 			}
 			else
@@ -212,14 +249,21 @@ int main(int argc, char const *argv[])
 		{
 			/* 最后处理定时事件，因为I/O事件优先级更高，不过这样做导致定时任务不能准确按照预期执行 */
 			timer_handler();
-			timeout = false;
 		}
+		else if (timer_lst.has_pending())
+		{
+			timer_lst.tick();
+		}
+		/* 本轮的添加、调整、删除和到期都可能改变最早的到期时间 */
+		rearm_timer();
 
 	}
 
 	close(listenfd);
+	close(timerfd);
 	close(pipefd[1]);
 	close(pipefd[0]);
+	timer_lst.get_stats().dump(stdout, "timer_lst");
 	delete [] users;
 
 	return 0;
@@ -0,0 +1,85 @@
+#ifndef MPSC_QUEUE
+#define MPSC_QUEUE
+
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * 有界无锁多生产者单消费者队列（Dmitry Vyukov的环形队列）
+ * 环形数组预先分配，每个格子带一个序号，生产者通过CAS抢占写入位置，
+ * 消费者只有一个，读位置不需要原子操作；入队出队都不加锁、不分配内存
+ * 容量必须是2的幂，队列满时push返回false
+ */
+template<typename T>
+class mpsc_queue
+{
+public:
+	mpsc_queue(size_t capacity): mask(capacity - 1), dequeue_pos(0)
+	{
+		buffer = new cell[capacity];
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			buffer[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		enqueue_pos.store(0, std::memory_order_relaxed);
+	}
+	~mpsc_queue()
+	{
+		delete [] buffer;
+	}
+
+	/* 任意线程调用 */
+	bool push(const T& data)
+	{
+		cell* c;
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			c = &buffer[pos & mask];
+			size_t seq = c->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0)
+			{
+				/* 格子空闲，尝试占有它 */
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			}
+			else if (diff < 0)
+			{
+				return false; // 队列已满
+			}
+			else
+			{
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		c->data = data;
+		c->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* 只能由消费者线程调用 */
+	bool pop(T& data)
+	{
+		cell* c = &buffer[dequeue_pos & mask];
+		size_t seq = c->sequence.load(std::memory_order_acquire);
+		if ((intptr_t)seq - (intptr_t)(dequeue_pos + 1) < 0) return false; // 队列为空
+		data = c->data;
+		c->sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+		++dequeue_pos;
+		return true;
+	}
+
+private:
+	struct cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	cell* buffer;
+	size_t mask;
+	alignas(64) std::atomic<size_t> enqueue_pos; // 生产者之间竞争的写位置
+	alignas(64) size_t dequeue_pos;              // 消费者独享的读位置
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef RESPONSE_CACHE
+#define RESPONSE_CACHE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * 预先序列化的应答缓存
+ * 每个静态资源的状态行、头部和空行只在第一次访问（或者文件被修改）时格式化一次，之后原样发送：
+ *   make_response()  生成固定的应答（例如8-3.cpp的200和400），头部和消息体都在内存中
+ *   response_cache   以URL为键缓存文件应答的头部，用文件的修改时间和大小校验，变化时重新生成；
+ *                    缓存项有引用计数（同fd_cache），发送中的头部不会因为重新生成或者淘汰而失效
+ * 热路径上只有一次查找和一次writev，不需要snprintf和strlen
+ */
+
+#define RESPONSE_CACHE_MAX 1024 /* 缓存的URL个数上限 */
+
+struct cached_response
+{
+	std::string url;    // 键，查找表中的string_view指向这里
+	std::string header; // 状态行、头部和空行
+	std::string body;   // 内存中的消息体，只有固定应答才有；文件应答的消息体由调用者发送
+	time_t mtime;       // 生成header时文件的修改时间和大小
+	long mtime_nsec;
+	off_t size;
+	int refs;           // 缓存项（response_cache、file_cache）正在被使用的次数
+	bool cached;        // 还在缓存中（被淘汰或者过期后为false，引用归零时释放）
+
+	cached_response(): mtime(0), mtime_nsec(0), size(0), refs(0), cached(false) {}
+
+	/* 填写头部和内存中的消息体，返回用掉的iovec个数（1或2） */
+	int fill_iov(struct iovec* iv) const
+	{
+		iv[0].iov_base = (void*)header.data();
+		iv[0].iov_len = header.size();
+		if (body.empty()) return 1;
+		iv[1].iov_base = (void*)body.data();
+		iv[1].iov_len = body.size();
+		return 2;
+	}
+
+	/* 文件的属性与生成头部时相同 */
+	bool fresh(const struct stat& st) const
+	{
+		return st.st_mtim.tv_sec == mtime && st.st_mtim.tv_nsec == mtime_nsec && st.st_size == size;
+	}
+};
+
+/* 按扩展名猜测Content-Type */
+inline const char* mime_type(std::string_view path)
+{
+	static const char* const types[][2] = {
+		{".html", "text/html; charset=UTF-8"},
+		{".htm", "text/html; charset=UTF-8"},
+		{".txt", "text/plain; charset=UTF-8"},
+		{".css", "text/css"},
+		{".js", "application/javascript"},
+		{".json", "application/json"},
+		{".png", "image/png"},
+		{".jpg", "image/jpeg"},
+		{".jpeg", "image/jpeg"},
+		{".gif", "image/gif"},
+		{".svg", "image/svg+xml"},
+		{".pdf", "application/pdf"}
+	};
+	size_t dot = path.rfind('.');
+	if (dot != std::string_view::npos)
+	{
+		std::string_view ext = path.substr(dot);
+		for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+		{
+			if (ext.size() == strlen(types[i][0]) && strncasecmp(ext.data(), types[i][0], ext.size()) == 0)
+			{
+				return types[i][1];
+			}
+		}
+	}
+	return "application/octet-stream";
+}
+
+/**
+ * 序列化头部：状态行、Content-Type、Content-Length，mtime >= 0时加上Last-Modified，
+ * extra是额外的头部行（每行以\r\n结尾），可以为NULL
+ */
+inline std::string serialize_header(const char* status, const char* content_type, off_t length, time_t mtime, const char* extra)
+{
+	char buf[512];
+	int len = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %lld\r\n",
+		status, content_type, (long long)length);
+	if (mtime >= 0 && len < (int)sizeof(buf))
+	{
+		struct tm tm;
+		gmtime_r(&mtime, &tm);
+		len += strftime(buf + len, sizeof(buf) - len, "Last-Modified: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+	}
+	std::string header(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+	if (extra) header += extra;
+	header += "\r\n";
+	return header;
+}
+
+/* 生成一个固定的应答 */
+inline cached_response make_response(const char* status, const char* content_type, std::string_view body, const char* extra = NULL)
+{
+	cached_response response;
+	response.header = serialize_header(status, content_type, body.size(), -1, extra);
+	response.body.assign(body.data(), body.size());
+	response.size = body.size();
+	return response;
+}
+
+class response_cache
+{
+public:
+	/* extra是每个头部都附加的行（每行以\r\n结尾），可以为NULL */
+	response_cache(size_t max = RESPONSE_CACHE_MAX, const char* extra = NULL): extra_header(extra), max_entries(max),
+		hits(0), misses(0), stale(0) {}
+	~response_cache()
+	{
+		clear();
+	}
+
+	/**
+	 * 查找url对应的文件应答，st是调用者刚取得的文件属性
+	 * 命中且文件没有变化时直接返回；不存在或者文件变化时生成新的头部，旧的项等使用者release之后才释放
+	 * 返回的项在调用release之前一直有效，发送时不需要复制头部
+	 */
+	const cached_response* acquire(std::string_view url, const struct stat& st)
+	{
+		auto it = entries.find(url);
+		if (it != entries.end())
+		{
+			cached_response* entry = it->second;
+			if (entry->fresh(st))
+			{
+				++hits;
+				++entry->refs;
+				return entry;
+			}
+			++stale;
+			detach(entry);
+		}
+		else
+		{
+			++misses;
+			if (entries.size() >= max_entries)
+			{
+				/* 简化处理：满了就淘汰任意一项 */
+				detach(entries.begin()->second);
+			}
+		}
+		cached_response* entry = new cached_response;
+		entry->url.assign(url.data(), url.size());
+		fill(entry, st);
+		entry->cached = true;
+		entries.emplace(std::string_view(entry->url), entry);
+		++entry->refs;
+		return entry;
+	}
+
+	void release(const cached_response* response)
+	{
+		cached_response* entry = const_cast<cached_response*>(response);
+		if (--entry->refs == 0 && !entry->cached) delete entry;
+	}
+
+	/* 删除url对应的项，例如知道文件已经被删除时 */
+	void remove(std::string_view url)
+	{
+		auto it = entries.find(url);
+		if (it == entries.end()) return;
+		detach(it->second);
+	}
+
+	void clear()
+	{
+		while (!entries.empty()) detach(entries.begin()->second);
+	}
+
+	size_t size() const { return entries.size(); }
+
+	void dump(FILE* out, const char* name) const
+	{
+		fprintf(out, "%s: %zu entries, %llu hits, %llu misses, %llu stale\n", name, entries.size(),
+			(unsigned long long)hits, (unsigned long long)misses, (unsigned long long)stale);
+	}
+
+private:
+	response_cache(const response_cache&);
+	response_cache& operator=(const response_cache&);
+
+	/* 移出缓存，没有人使用时立即释放 */
+	void detach(cached_response* entry)
+	{
+		entries.erase(std::string_view(entry->url));
+		entry->cached = false;
+		if (entry->refs == 0) delete entry;
+	}
+
+	/* 按文件的当前属性生成头部 */
+	void fill(cached_response* entry, const struct stat& st)
+	{
+		entry->header = serialize_header("200 OK", mime_type(entry->url), st.st_size, st.st_mtim.tv_sec, extra_header);
+		entry->mtime = st.st_mtim.tv_sec;
+		entry->mtime_nsec = st.st_mtim.tv_nsec;
+		entry->size = st.st_size;
+	}
+
+	std::unordered_map<std::string_view, cached_response*> entries;
+	const char* extra_header;
+	size_t max_entries;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stale;
+};
+
+#endif
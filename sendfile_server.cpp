@@ -0,0 +1,859 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <string>
+#include "http_conn.h"
+#include "response_cache.h"
+#include "fd_cache.h"
+#include "uring.h"
+
+/**
+ * 基于sendfile的静态文件服务器
+ * 用法: sendfile_server ip port docroot
+ * 6-3.c在阻塞的socket上调用一次sendfile就认为文件发完了；这里socket是非阻塞的，由ET模式的epoll驱动：
+ *   每个连接记录文件的当前偏移，sendfile写满发送缓冲区（EAGAIN）时停下，EPOLLOUT到来时从偏移处继续
+ *   支持单个区间的Range请求（206），区间不可满足时应答416
+ *   头部用带MSG_MORE的sendmsg发送（效果与TCP_CORK相同），内核把它和随后sendfile的文件数据合并成满的报文
+ * 文件数据不经过用户空间，一个线程可以同时服务大量的下载
+ * 打开的文件和它的属性由fd_cache缓存，inotify的fd注册在epoll中，热点文件的请求不做任何路径查找
+ * 有io_uring时（见uring.h），发送前用mincore检查文件区间是否在页缓存中：在的部分照常sendfile，零拷贝且不会阻塞；
+ * 不在的部分（冷数据）改用io_uring异步地读到缓冲区再发送，由内核的工作线程去读盘，不会阻塞事件循环
+ * 一轮事件循环中所有连接的io_uring操作用一次io_uring_enter提交，完成通过eventfd回到epoll
+ * 内核不支持io_uring时全部使用sendfile
+ * kill -USR1 打印连接数和头部缓存的统计，kill -TERM 退出
+ */
+
+#define MAX_FD 65536
+#define MAX_EVENT_NUMBER 1024
+#define MAX_PATH 1024
+#define URING_ENTRIES 4096 /* io_uring提交队列的大小 */
+#define RESIDENT_WINDOW (256 * 1024) /* 每次用mincore检查多大的文件区间 */
+
+static const cached_response bad_reply = make_response("400 Bad Request", "text/plain; charset=UTF-8",
+	"Bad Request\n", "Connection: close\r\n");
+static const cached_response forbidden_reply = make_response("403 Forbidden", "text/plain; charset=UTF-8", "Forbidden\n");
+static const cached_response not_found_reply = make_response("404 Not Found", "text/plain; charset=UTF-8", "Not Found\n");
+static const cached_response not_allowed_reply = make_response("405 Method Not Allowed", "text/plain; charset=UTF-8",
+	"Method Not Allowed\n", "Allow: GET\r\n");
+
+static const char* docroot = NULL;
+/* 完整文件（200）的头部，按路径缓存；告诉客户端可以用Range续传 */
+static response_cache header_cache(RESPONSE_CACHE_MAX, "Accept-Ranges: bytes\r\n");
+static fd_cache open_files;         /* 打开的文件，多个连接共用一个fd，各自维护偏移 */
+#if HAVE_IO_URING
+static uring* ring = NULL;          /* 为NULL时使用sendfile */
+
+/* 一个连接正在进行的io_uring操作，每个连接同时最多一个 */
+enum IO_STATE
+{
+	IO_IDLE = 0,
+	IO_READ,  // 读冷数据到io_buf
+	IO_SEND,  // 发送io_buf中的数据
+	IO_POLL   // 发送缓冲区满，等待socket可写
+};
+#endif
+
+/**
+ * 分析Range字段的值，只支持单个区间：bytes=a-b、bytes=a-、bytes=-n
+ * 返回1表示得到区间[first, last]，0表示忽略Range（语法错误或多个区间，发送整个文件），-1表示区间不可满足
+ */
+static int parse_range(std::string_view value, off_t size, off_t& first, off_t& last)
+{
+	if (value.size() < 6 || strncasecmp(value.data(), "bytes=", 6) != 0) return 0;
+	value.remove_prefix(6);
+	if (value.find(',') != std::string_view::npos) return 0;
+	size_t dash = value.find('-');
+	if (dash == std::string_view::npos) return 0;
+	uint64_t a = 0, b = 0;
+	bool has_a = dash > 0, has_b = dash + 1 < value.size();
+	if (!has_a && !has_b) return 0;
+	if (has_a && !parse_length(value.substr(0, dash), a)) return 0;
+	if (has_b && !parse_length(value.substr(dash + 1), b)) return 0;
+	if (!has_a)
+	{
+		/* 最后b个字节 */
+		if (b == 0 || size == 0) return -1;
+		first = b >= (uint64_t)size ? 0 : size - b;
+		last = size - 1;
+		return 1;
+	}
+	if (has_b && b < a) return 0;
+	if (a >= (uint64_t)size) return -1;
+	first = a;
+	last = has_b && b < (uint64_t)size ? b : size - 1;
+	return 1;
+}
+
+/**
+ * 一个下载连接
+ * 请求的接收和解析与http_conn相同，但一次只处理一个请求：应答（头部和文件区间）发完之后才解析下一个流水线请求
+ */
+class file_conn
+{
+public:
+	file_conn(): sockfd(-1), file(NULL), cached_header(NULL), buffer(CONN_MAX_REQUEST)
+	{
+#if HAVE_IO_URING
+		io_state = IO_IDLE;
+		io_buf = NULL;
+		dead = false;
+#endif
+	}
+
+	void init(int fd)
+	{
+		sockfd = fd;
+#if HAVE_IO_URING
+		io_state = IO_IDLE;
+		dead = false;
+#endif
+		read_index = start_line = checked_index = request_start = 0;
+		checkstats = CHECK_STATE_REQUESTLINE;
+		request.reset();
+		iv_count = 0;
+		offset = end = 0;
+		sending = false;
+		input_ready = true;
+		closing = false;
+	}
+
+	void close_conn()
+	{
+		if (sockfd < 0) return;
+#if HAVE_IO_URING
+		if (dead) return;
+		if (io_state != IO_IDLE)
+		{
+			/* 还有操作在内核中，缓冲区和socket都不能释放；shutdown让等待中的发送和poll立即结束，
+			   完成时再真正关闭。fd没有关闭，不会被新连接复用 */
+			shutdown(sockfd, SHUT_RDWR);
+			dead = true;
+			return;
+		}
+#endif
+		finish_response();
+		close(sockfd);
+		sockfd = -1;
+		buffer.clear();
+	}
+
+#if HAVE_IO_URING
+	int fd() const { return dead ? -1 : sockfd; }
+#else
+	int fd() const { return sockfd; }
+#endif
+
+	CONN_STATUS on_readable()
+	{
+		input_ready = true;
+		return serve();
+	}
+
+	CONN_STATUS on_writable()
+	{
+		if (!sending && !input_ready) return CONN_READ;
+		return serve();
+	}
+
+	/* 发送当前的应答，发完后解析下一个请求，需要时再读入，直到必须等待I/O为止 */
+	CONN_STATUS serve()
+	{
+		while (true)
+		{
+			if (sending)
+			{
+#if HAVE_IO_URING
+				/* 冷数据的读和发送由io_uring的完成推进 */
+				if (io_state != IO_IDLE) return CONN_WRITE;
+#endif
+				int ret = send_response();
+#if HAVE_IO_URING
+				if (ret == 2) return start_cold_read() ? CONN_WRITE : CONN_CLOSE;
+#endif
+				if (ret < 0) return CONN_CLOSE;
+				if (ret == 0) return CONN_WRITE; // 发送缓冲区满了，等待EPOLLOUT
+				finish_response();
+				if (closing) return CONN_CLOSE;
+				continue;
+			}
+			if (parse()) continue;
+			if (!input_ready) return CONN_READ;
+			int ret = fill();
+			if (ret == 0) return CONN_CLOSE;
+			if (ret < 0) return CONN_READ;
+		}
+	}
+
+#if HAVE_IO_URING
+	/* 这个连接的一个io_uring操作完成了，res是操作的结果 */
+	CONN_STATUS on_complete(int res)
+	{
+		IO_STATE state = io_state;
+		io_state = IO_IDLE;
+		if (dead)
+		{
+			close_dead();
+			return CONN_READ;
+		}
+		if (res == -EINTR)
+		{
+			/* 重新提交同一个操作 */
+			if (state == IO_READ) return submit_read() ? CONN_WRITE : CONN_CLOSE;
+			if (state == IO_SEND) return submit_send() ? CONN_WRITE : CONN_CLOSE;
+			return submit_poll() ? CONN_WRITE : CONN_CLOSE;
+		}
+		if (state == IO_READ)
+		{
+			if (res <= 0) return CONN_CLOSE; // 读文件出错，或者文件被截短了
+			offset += res;
+			io_len += res;
+			return submit_send() ? CONN_WRITE : CONN_CLOSE;
+		}
+		if (state == IO_POLL)
+		{
+			if (res < 0 || (res & (POLLERR | POLLHUP))) return CONN_CLOSE;
+			return submit_send() ? CONN_WRITE : CONN_CLOSE;
+		}
+		if (res == -EAGAIN) return submit_poll() ? CONN_WRITE : CONN_CLOSE;
+		if (res < 0) return CONN_CLOSE;
+		io_sent += res;
+		if (io_sent < io_len) return submit_send() ? CONN_WRITE : CONN_CLOSE;
+		io_len = io_sent = 0;
+		/* 冷数据发完了，剩下的部分重新检查（预读可能已经把它读进页缓存） */
+		return serve();
+	}
+#endif
+
+private:
+#if HAVE_IO_URING
+	/**
+	 * 从offset开始、最多len字节中已经在页缓存里的前缀长度，sendfile发送这部分不会读盘
+	 * 映射来自fd_cache的缓存项（只用于mincore，不访问），热点文件不需要每次映射；
+	 * 映射或者mincore失败时认为都在页缓存中
+	 */
+	off_t resident(off_t len)
+	{
+		static const long page = sysconf(_SC_PAGESIZE);
+		const char* map = file->mapping();
+		if (!map) return len;
+		if (len > RESIDENT_WINDOW) len = RESIDENT_WINDOW;
+		off_t first = offset / page * page;
+		size_t pages = (offset + len - first + page - 1) / page;
+		unsigned char vec[RESIDENT_WINDOW / 4096 + 2];
+		if (mincore((void*)(map + first), offset + len - first, vec) < 0) return len;
+		size_t i = 0;
+		while (i < pages && (vec[i] & 1)) ++i;
+		if (i == pages) return len;
+		return first + (off_t)i * page - offset;
+	}
+
+	/* offset处的数据不在页缓存中，交给io_uring读到io_buf再发送 */
+	bool start_cold_read()
+	{
+		if (!io_buf) io_buf = chunk_pool::local().alloc(CHAIN_CHUNK_CLASSES - 1);
+		io_len = io_sent = 0;
+		return submit_read();
+	}
+
+	bool submit_read()
+	{
+		io_uring_sqe* sqe = ring->get_sqe();
+		if (!sqe) return false;
+		off_t room = io_buf->size - io_len;
+		unsigned len = (unsigned)(end - offset < room ? end - offset : room);
+		uring::prep_read(sqe, file->fd, io_buf->data() + io_len, len, offset, (uint64_t)(uintptr_t)this);
+		io_state = IO_READ;
+		return true;
+	}
+
+	bool submit_send()
+	{
+		io_uring_sqe* sqe = ring->get_sqe();
+		if (!sqe) return false;
+		/* 后面还有文件数据时告诉内核先不要发出不满的报文 */
+		uring::prep_send(sqe, sockfd, io_buf->data() + io_sent, io_len - io_sent,
+			MSG_NOSIGNAL | (offset < end ? MSG_MORE : 0), (uint64_t)(uintptr_t)this);
+		io_state = IO_SEND;
+		return true;
+	}
+
+	/* 非阻塞的socket上发送可能返回EAGAIN，由io_uring等socket可写，不依赖ET模式下可能已经错过的EPOLLOUT */
+	bool submit_poll()
+	{
+		io_uring_sqe* sqe = ring->get_sqe();
+		if (!sqe) return false;
+		uring::prep_poll(sqe, sockfd, POLLOUT, (uint64_t)(uintptr_t)this);
+		io_state = IO_POLL;
+		return true;
+	}
+
+	/* 关闭时还有操作在内核中的连接，在操作完成后关闭 */
+	void close_dead()
+	{
+		dead = false;
+		finish_response();
+		close(sockfd);
+		sockfd = -1;
+		buffer.clear();
+	}
+#endif
+
+	/* 读入一次数据，返回值同http_conn::fill */
+	int fill()
+	{
+		if (request_start == buffer.size() && !buffer.has_more())
+		{
+			buffer.rewind();
+			read_index = start_line = checked_index = request_start = 0;
+		}
+		while (true)
+		{
+			ssize_t ret = buffer.read(sockfd);
+			if (ret > 0) return (int)ret;
+			if (ret < 0 && errno == EINTR) continue;
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				input_ready = false;
+				if (request_start == buffer.size() && !buffer.has_more()) buffer.clear();
+				return -1;
+			}
+			return 0;
+		}
+	}
+
+	/* 解析出一个请求并准备好它的应答时返回true，数据不够时返回false */
+	bool parse()
+	{
+		while (true)
+		{
+			if (request_start == buffer.size() && !buffer.has_more()) return false;
+			read_index = buffer.size();
+			HTTP_CODE result = parse_content(buffer.data(), checked_index, checkstats, read_index, start_line, request);
+			if (result == NO_REQUEST)
+			{
+				if (!buffer.has_more()) return false;
+				drop_body();
+				const char* from = buffer.data() + request_start;
+				int keep = buffer.linearize(request_start);
+				if (keep < 0)
+				{
+					start_static(bad_reply);
+					closing = true;
+					return true;
+				}
+				request.rebase(from, buffer.data() + keep);
+				request.body_offset += keep - request_start;
+				start_line += keep - request_start;
+				checked_index += keep - request_start;
+				request_start = keep;
+			}
+			else if (result == GET_REQUEST)
+			{
+				closing = !keep_alive(request);
+				prepare();
+				checkstats = CHECK_STATE_REQUESTLINE;
+				request.reset();
+				request_start = start_line = checked_index;
+				return true;
+			}
+			else
+			{
+				start_static(bad_reply);
+				closing = true;
+				return true;
+			}
+		}
+	}
+
+	/* 请求的消息体用不到，交出去之后就从缓冲区中删掉 */
+	void drop_body()
+	{
+		if (checkstats == CHECK_STATE_CONTENT && start_line > request.body_offset)
+		{
+			int len = start_line - request.body_offset;
+			buffer.erase(request.body_offset, start_line);
+			checked_index -= len;
+			start_line -= len;
+		}
+	}
+
+	/* 根据请求打开文件，准备头部和要发送的文件区间 */
+	void prepare()
+	{
+		if (!slice_equal(request.method, "GET"))
+		{
+			start_static(not_allowed_reply);
+			return;
+		}
+		std::string_view url = request.url;
+		size_t query = url.find('?');
+		if (query != std::string_view::npos) url = url.substr(0, query);
+		if (url.find("..") != std::string_view::npos)
+		{
+			start_static(forbidden_reply);
+			return;
+		}
+		int len = snprintf(path, sizeof(path), "%s%.*s%s", docroot, (int)url.size(), url.data(),
+			url.back() == '/' ? "index.html" : "");
+		if (len >= (int)sizeof(path))
+		{
+			start_static(not_found_reply);
+			return;
+		}
+		file = open_files.acquire(std::string_view(path, len));
+		if (!file || !S_ISREG(file->st.st_mode))
+		{
+			const cached_response& reply = !file && errno == EACCES ? forbidden_reply : not_found_reply;
+			finish_response();
+			start_static(reply);
+			return;
+		}
+		const struct stat& st = file->st;
+		if (!(st.st_mode & S_IROTH))
+		{
+			finish_response();
+			start_static(forbidden_reply);
+			return;
+		}
+
+		off_t first = 0, last = st.st_size - 1;
+		int range = 0;
+		const http_header* h = request.get(HEADER_RANGE);
+		/* 带If-Range时不比较validator，直接发送整个文件，这总是正确的 */
+		if (h && !request.get(HEADER_IF_RANGE)) range = parse_range(h->value, st.st_size, first, last);
+		char extra[128];
+		if (range < 0)
+		{
+			snprintf(extra, sizeof(extra), "Content-Range: bytes */%lld\r\n", (long long)st.st_size);
+			header = serialize_header("416 Range Not Satisfiable", "text/plain; charset=UTF-8", 0, -1, extra);
+			finish_response();
+		}
+		else if (range > 0)
+		{
+			/* 部分内容的头部随区间变化，只能每次生成 */
+			snprintf(extra, sizeof(extra), "Accept-Ranges: bytes\r\nContent-Range: bytes %lld-%lld/%lld\r\n",
+				(long long)first, (long long)last, (long long)st.st_size);
+			header = serialize_header("206 Partial Content", mime_type(url), last - first + 1, st.st_mtim.tv_sec, extra);
+			offset = first;
+			end = last + 1;
+		}
+		else
+		{
+			/* 整个文件的头部来自缓存，直接从缓存项发送，不复制不格式化 */
+			cached_header = header_cache.acquire(std::string_view(path, len), st);
+			iv_count = cached_header->fill_iov(iv);
+			offset = 0;
+			end = st.st_size;
+			sending = true;
+			return;
+		}
+		iv[0].iov_base = (void*)header.data();
+		iv[0].iov_len = header.size();
+		iv_count = 1;
+		sending = true;
+	}
+
+	/* 发送内存中的固定应答 */
+	void start_static(const cached_response& reply)
+	{
+		iv_count = reply.fill_iov(iv);
+		offset = end = 0;
+		sending = true;
+	}
+
+	/* 返回1表示发完，0表示发送缓冲区满，-1表示出错，2表示offset处是冷数据（只在使用io_uring时） */
+	int send_response()
+	{
+		while (iv_count > 0)
+		{
+			struct msghdr msg;
+			memset(&msg, '\0', sizeof(msg));
+			msg.msg_iov = iv;
+			msg.msg_iovlen = iv_count;
+			/* 后面还有文件数据时告诉内核先不要发出不满的报文 */
+			ssize_t n = sendmsg(sockfd, &msg, MSG_NOSIGNAL | (offset < end ? MSG_MORE : 0));
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+				return -1;
+			}
+			int first = 0;
+			while (first < iv_count && (size_t)n >= iv[first].iov_len)
+			{
+				n -= iv[first].iov_len;
+				++first;
+			}
+			if (first < iv_count)
+			{
+				iv[first].iov_base = (char*)iv[first].iov_base + n;
+				iv[first].iov_len -= n;
+			}
+			memmove(iv, iv + first, (iv_count - first) * sizeof(struct iovec));
+			iv_count -= first;
+		}
+		while (offset < end)
+		{
+			off_t len = end - offset;
+#if HAVE_IO_URING
+			if (ring)
+			{
+				/* 只用sendfile发送页缓存中的数据，不在的交给io_uring，sendfile不会因为读盘阻塞事件循环 */
+				len = resident(len);
+				if (len == 0) return 2;
+			}
+#endif
+			ssize_t n = sendfile(sockfd, file->fd, &offset, len);
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+				return -1;
+			}
+			if (n == 0) return -1; // 文件在发送过程中被截短了，已经发出的Content-Length无法兑现
+		}
+		return 1;
+	}
+
+	void finish_response()
+	{
+		if (file)
+		{
+			open_files.release(file);
+			file = NULL;
+		}
+		if (cached_header)
+		{
+			header_cache.release(cached_header);
+			cached_header = NULL;
+		}
+		iv_count = 0;
+		offset = end = 0;
+		sending = false;
+#if HAVE_IO_URING
+		if (io_buf)
+		{
+			chunk_pool::local().free(io_buf);
+			io_buf = NULL;
+		}
+#endif
+	}
+
+private:
+	int sockfd;
+	fd_entry* file;            // 正在发送的文件
+	off_t offset;              // 下一个要发送的字节
+	off_t end;                 // 要发送的区间的结束位置
+	const cached_response* cached_header; // 来自header_cache的头部（200），发完后release
+	std::string header;        // 每次生成的头部（206和416）
+	struct iovec iv[2];        // 还没发出的头部（和固定应答的消息体）
+	int iv_count;
+	bool sending;              // 有应答正在发送
+	chain_buffer buffer;
+	int read_index;
+	int start_line;
+	int checked_index;
+	int request_start;
+	CHECK_STATE checkstats;
+	http_request request;
+	bool input_ready;
+	bool closing;
+	char path[MAX_PATH];
+#if HAVE_IO_URING
+	IO_STATE io_state;
+	buffer_chunk* io_buf;      // 读冷数据和发送用的缓冲区，应答发完就还给chunk_pool
+	int io_len;                // io_buf中数据的长度
+	int io_sent;               // io_buf中已经发出的长度
+	bool dead;                 // 已经关闭，等待进行中的操作完成
+#endif
+};
+
+static int pipefd[2];
+static int epollfd = 0;
+static file_conn** conns = NULL;
+static int conn_count = 0;
+
+int setnonblocking(int fd)
+{
+	int old_opt = fcntl(fd, F_GETFL);
+	int new_opt = old_opt | O_NONBLOCK;
+	fcntl(fd, F_SETFL, new_opt);
+	return old_opt;
+}
+
+void addfd(int epollfd, int fd, uint32_t events)
+{
+	epoll_event event;
+	event.data.fd = fd;
+	event.events = events | EPOLLET;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+	setnonblocking(fd);
+}
+
+void sig_handler(int sig)
+{
+	int save_errno = errno;
+	int msg = sig;
+	send(pipefd[1], (char*)&msg, 1, 0);
+	errno = save_errno;
+}
+
+void addsig(int sig)
+{
+	struct sigaction sa;
+	memset(&sa, '\0', sizeof(sa));
+	sa.sa_handler = sig_handler;
+	sa.sa_flags |= SA_RESTART;
+	sigfillset(&sa.sa_mask);
+	assert(sigaction(sig, &sa, NULL) != -1);
+}
+
+void close_conn(int sockfd)
+{
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, sockfd, 0);
+	conns[sockfd]->close_conn();
+	--conn_count;
+}
+
+#if HAVE_IO_URING
+/* 把一个操作的结果交给对应的连接 */
+void complete(uint64_t user_data, int res)
+{
+	file_conn* conn = (file_conn*)(uintptr_t)user_data;
+	CONN_STATUS status = conn->on_complete(res);
+	if (status == CONN_CLOSE && conn->fd() >= 0) close_conn(conn->fd());
+}
+
+/* 取出所有的完成项，交给对应的连接 */
+void reap_completions()
+{
+	io_uring_cqe* cqe;
+	while ((cqe = ring->peek()) != NULL)
+	{
+		uint64_t user_data = cqe->user_data;
+		int res = cqe->res;
+		ring->advance();
+		complete(user_data, res);
+	}
+}
+
+/**
+ * 提交本轮所有连接准备的操作
+ * EAGAIN、EBUSY（内核资源暂时不足、完成队列满）时操作留在队列中，先取走完成项，下一轮再提交；
+ * 其他错误时这些操作不会再完成，取回它们并以失败结束，对应的连接被关闭，不会停在等待中
+ */
+void submit_ring()
+{
+	if (ring->submit() >= 0) return;
+	if (errno == EAGAIN || errno == EBUSY)
+	{
+		reap_completions();
+		return;
+	}
+	printf("io_uring_enter error: %d\n", errno);
+	uint64_t user_data;
+	while (ring->unsubmit(user_data))
+	{
+		complete(user_data, -ECANCELED);
+	}
+}
+#endif
+
+void accept_all(int listenfd)
+{
+	while (true)
+	{
+		struct sockaddr_in client_address;
+		socklen_t client_addrlength = sizeof(client_address);
+		int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+		if (connfd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) printf("accept error: %d\n", errno);
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (connfd >= MAX_FD)
+		{
+			close(connfd);
+			continue;
+		}
+		addfd(epollfd, connfd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+		if (!conns[connfd]) conns[connfd] = new file_conn;
+		conns[connfd]->init(connfd);
+		++conn_count;
+	}
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc <= 3)
+	{
+		printf("usage: %s ip port docroot\n", basename(argv[0]));
+		return 1;
+	}
+	const char* ip = argv[1];
+	int port = atoi(argv[2]);
+	docroot = argv[3];
+
+	int ret = 0;
+	struct sockaddr_in address;
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	inet_pton(AF_INET, ip, &address.sin_addr);
+	address.sin_port = htons(port);
+
+	int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+	assert(listenfd >= 0);
+	int reuse = 1;
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
+	assert(ret != -1);
+	ret = listen(listenfd, SOMAXCONN);
+	assert(ret != -1);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	epoll_event events[MAX_EVENT_NUMBER];
+	epollfd = epoll_create(5);
+	assert(epollfd != -1);
+	addfd(epollfd, listenfd, EPOLLIN);
+
+	ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
+	assert(ret != -1);
+	setnonblocking(pipefd[1]);
+	addfd(epollfd, pipefd[0], EPOLLIN);
+	if (open_files.notify_fd() >= 0) addfd(epollfd, open_files.notify_fd(), EPOLLIN);
+	addsig(SIGTERM);
+	addsig(SIGUSR1);
+	bool stop_server = false;
+	conns = new file_conn*[MAX_FD]();
+#if HAVE_IO_URING
+	ring = new uring;
+	if (ring->init(URING_ENTRIES))
+	{
+		addfd(epollfd, ring->event_fd(), EPOLLIN);
+		printf("file data via io_uring\n");
+	}
+	else
+	{
+		printf("io_uring unavailable (errno %d), using sendfile\n", errno);
+		delete ring;
+		ring = NULL;
+	}
+#endif
+
+	while (!stop_server)
+	{
+		int timeout = -1;
+#if HAVE_IO_URING
+		/* 有暂时没能提交的操作时不要一直阻塞，稍后重试 */
+		if (ring && ring->unsubmitted() > 0) timeout = 1;
+#endif
+		int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, timeout);
+		if ((number < 0) && (errno != EINTR))
+		{
+			printf("epoll failure\n");
+			break;
+		}
+		for (int i = 0; i < number; ++i)
+		{
+			int sockfd = events[i].data.fd;
+			uint32_t ev = events[i].events;
+			if (sockfd == listenfd)
+			{
+				accept_all(listenfd);
+			}
+#if HAVE_IO_URING
+			else if (ring && sockfd == ring->event_fd())
+			{
+				uint64_t count;
+				read(sockfd, &count, sizeof(count));
+				reap_completions();
+			}
+#endif
+			else if (sockfd == open_files.notify_fd())
+			{
+				open_files.process_events();
+			}
+			else if (sockfd == pipefd[0])
+			{
+				char signals[1024];
+				ret = recv(pipefd[0], signals, sizeof(signals), 0);
+				for (int k = 0; k < ret; ++k)
+				{
+					if (signals[k] == SIGTERM)
+					{
+						stop_server = true;
+					}
+					else if (signals[k] == SIGUSR1)
+					{
+						printf("%d connections\n", conn_count);
+						header_cache.dump(stdout, "header_cache");
+						open_files.dump(stdout, "open_files");
+					}
+				}
+			}
+			else if (conns[sockfd] && conns[sockfd]->fd() >= 0)
+			{
+				CONN_STATUS status;
+				if (ev & (EPOLLHUP | EPOLLERR))
+				{
+					status = CONN_CLOSE;
+				}
+				else
+				{
+					status = CONN_READ;
+					/* 读和写都可能就绪，serve()会把能做的都做完 */
+					if (ev & (EPOLLIN | EPOLLRDHUP))
+					{
+						status = conns[sockfd]->on_readable();
+					}
+					else if (ev & EPOLLOUT)
+					{
+						status = conns[sockfd]->on_writable();
+					}
+				}
+				if (status == CONN_CLOSE)
+				{
+					close_conn(sockfd);
+				}
+			}
+		}
+#if HAVE_IO_URING
+		/* 本轮所有连接准备的操作一次提交 */
+		if (ring) submit_ring();
+#endif
+	}
+
+#if HAVE_IO_URING
+	/* 先关闭io_uring，内核不再使用连接的缓冲区 */
+	delete ring;
+	ring = NULL;
+#endif
+	for (int fd = 0; fd < MAX_FD; ++fd)
+	{
+		if (!conns[fd]) continue;
+		if (conns[fd]->fd() >= 0) close_conn(fd);
+		delete conns[fd];
+	}
+	close(listenfd);
+	close(pipefd[1]);
+	close(pipefd[0]);
+	close(epollfd);
+	header_cache.dump(stdout, "header_cache");
+	delete [] conns;
+	return 0;
+}
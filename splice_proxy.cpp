@@ -0,0 +1,424 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/**
+ * 基于splice的四层TCP代理
+ * 用法: splice_proxy ip port upstream_ip:port [upstream_ip:port ...]
+ * 6-4.c在一个阻塞的连接上用splice经过管道回射数据；这里每个客户连接以非阻塞方式连接一个上游（轮流选择，
+ * 连接失败时换下一个），两个方向各用一个管道，在ET模式的epoll下用splice搬运：
+ *   socket -> 管道 -> socket，数据只在内核中移动，不经过用户空间的缓冲区
+ *   背压：管道满时停止从来源读，数据留在来源socket的接收缓冲区中，TCP的窗口让对方慢下来；
+ *         目的端可写时先把管道中的数据发出，再继续读来源
+ *   一端关闭写（读到EOF）时，管道中的数据发完后对另一端shutdown(SHUT_WR)，两个方向都结束后关闭会话
+ * kill -USR1 打印会话数和转发的字节数，kill -TERM 退出
+ */
+
+#define MAX_FD 65536
+#define MAX_EVENT_NUMBER 1024
+#define MAX_UPSTREAM 16
+#define PIPE_SIZE 65536 /* 每个方向的管道容量，即会话在内核中缓冲的最大数据量 */
+
+/* 一个方向：从src读，经过管道写到dst */
+struct flow
+{
+	int pipe_r;
+	int pipe_w;
+	int pending; // 管道中的字节数
+	bool eof;    // src已经读到EOF
+	bool done;   // 数据已经全部发出，并且已经shutdown了dst的写
+};
+
+struct session
+{
+	int client;
+	int upstream;
+	bool connecting;  // 上游的非阻塞connect还没有完成
+	int next_upstream; // 连接失败时尝试的下一个上游
+	int tries;         // 已经尝试的上游个数
+	flow up;           // client -> upstream
+	flow down;         // upstream -> client
+};
+
+static int pipefd[2];
+static int epollfd = 0;
+static session** sessions = NULL; /* 以fd为下标，客户端和上游的fd都指向同一个会话 */
+static struct sockaddr_in upstreams[MAX_UPSTREAM];
+static int upstream_count = 0;
+static int round_robin = 0;
+static int session_count = 0;
+static unsigned long long bytes_up = 0;
+static unsigned long long bytes_down = 0;
+
+int setnonblocking(int fd)
+{
+	int old_opt = fcntl(fd, F_GETFL);
+	int new_opt = old_opt | O_NONBLOCK;
+	fcntl(fd, F_SETFL, new_opt);
+	return old_opt;
+}
+
+void addfd(int epollfd, int fd, uint32_t events)
+{
+	epoll_event event;
+	event.data.fd = fd;
+	event.events = events | EPOLLET;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+	setnonblocking(fd);
+}
+
+void sig_handler(int sig)
+{
+	int save_errno = errno;
+	int msg = sig;
+	send(pipefd[1], (char*)&msg, 1, 0);
+	errno = save_errno;
+}
+
+void addsig(int sig)
+{
+	struct sigaction sa;
+	memset(&sa, '\0', sizeof(sa));
+	sa.sa_handler = sig_handler;
+	sa.sa_flags |= SA_RESTART;
+	sigfillset(&sa.sa_mask);
+	assert(sigaction(sig, &sa, NULL) != -1);
+}
+
+/* 解析"ip:port" */
+bool parse_address(const char* text, struct sockaddr_in& address)
+{
+	const char* colon = strrchr(text, ':');
+	if (!colon || colon == text) return false;
+	char ip[64];
+	int len = colon - text;
+	if (len >= (int)sizeof(ip)) return false;
+	memcpy(ip, text, len);
+	ip[len] = '\0';
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(atoi(colon + 1));
+	return inet_pton(AF_INET, ip, &address.sin_addr) == 1 && address.sin_port != 0;
+}
+
+bool open_flow(flow& f)
+{
+	int fds[2];
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) return false;
+	fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+	f.pipe_r = fds[0];
+	f.pipe_w = fds[1];
+	f.pending = 0;
+	f.eof = false;
+	f.done = false;
+	return true;
+}
+
+void close_flow(flow& f)
+{
+	if (f.pipe_r >= 0) close(f.pipe_r);
+	if (f.pipe_w >= 0) close(f.pipe_w);
+	f.pipe_r = f.pipe_w = -1;
+}
+
+void close_session(session* s)
+{
+	if (s->client >= 0)
+	{
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, s->client, 0);
+		sessions[s->client] = NULL;
+		close(s->client);
+	}
+	if (s->upstream >= 0)
+	{
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, s->upstream, 0);
+		sessions[s->upstream] = NULL;
+		close(s->upstream);
+	}
+	close_flow(s->up);
+	close_flow(s->down);
+	delete s;
+	--session_count;
+}
+
+/* 以非阻塞方式连接下一个上游，返回false表示所有上游都试过了 */
+bool connect_upstream(session* s)
+{
+	while (s->tries < upstream_count)
+	{
+		const struct sockaddr_in& address = upstreams[s->next_upstream];
+		s->next_upstream = (s->next_upstream + 1) % upstream_count;
+		++s->tries;
+		int fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0) return false;
+		if (fd >= MAX_FD)
+		{
+			close(fd);
+			return false;
+		}
+		int ret = connect(fd, (struct sockaddr*)&address, sizeof(address));
+		if (ret < 0 && errno != EINPROGRESS)
+		{
+			close(fd);
+			continue;
+		}
+		s->upstream = fd;
+		s->connecting = ret < 0;
+		sessions[fd] = s;
+		/* 连接完成时socket变为可写 */
+		addfd(epollfd, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * 推进一个方向，直到来源没有数据（EAGAIN）或者管道满且目的端写不进去
+ * 返回false表示出错，会话应当关闭
+ */
+bool pump(flow& f, int src, int dst, unsigned long long& bytes)
+{
+	while (!f.done)
+	{
+		/* 先把管道中的数据发出去，给读来源腾出空间 */
+		bool dst_blocked = false;
+		while (f.pending > 0)
+		{
+			/* 不带SPLICE_F_MORE：它对目的端相当于MSG_MORE，一轮数据的最后一段不满的报文会被TCP扣住，
+			   而来源什么时候再有数据无从知道，请求/应答式的流量每次都要多等约200ms */
+			ssize_t n = splice(f.pipe_r, NULL, dst, NULL, f.pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n > 0)
+			{
+				f.pending -= n;
+				bytes += n;
+				continue;
+			}
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN)
+			{
+				dst_blocked = true; // 目的端的发送缓冲区满了，等待它的EPOLLOUT
+				break;
+			}
+			return false;
+		}
+		if (f.eof)
+		{
+			if (f.pending > 0) return true;
+			/* 来源关闭了写，数据都已发出，把关闭传给目的端 */
+			shutdown(dst, SHUT_WR);
+			f.done = true;
+			return true;
+		}
+		if (f.pending >= PIPE_SIZE)
+		{
+			/* 管道满了：目的端写不进去时停止读来源，这就是背压 */
+			if (dst_blocked) return true;
+			continue;
+		}
+		ssize_t n = splice(src, NULL, f.pipe_w, NULL, PIPE_SIZE - f.pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0)
+		{
+			f.pending += n;
+			continue;
+		}
+		if (n == 0)
+		{
+			f.eof = true;
+			continue;
+		}
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN)
+		{
+			/* 来源的数据读完了（ET模式下等下一个EPOLLIN），或者管道满了 */
+			if (f.pending > 0 && !dst_blocked) continue;
+			return true;
+		}
+		return false;
+	}
+	return true;
+}
+
+/* 会话的任意一端有事件时，两个方向都推进一遍 */
+void handle_session(session* s, int fd, uint32_t ev)
+{
+	if (s->connecting)
+	{
+		if (fd != s->upstream) return; // 上游连上之前客户端的数据留在它的接收缓冲区中
+		int error = 0;
+		socklen_t len = sizeof(error);
+		getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+		if (error != 0 || (ev & (EPOLLERR | EPOLLHUP)))
+		{
+			/* 换下一个上游 */
+			epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+			sessions[fd] = NULL;
+			close(fd);
+			s->upstream = -1;
+			if (!connect_upstream(s)) close_session(s);
+			return;
+		}
+		s->connecting = false;
+	}
+	else if (ev & EPOLLERR)
+	{
+		close_session(s);
+		return;
+	}
+	if (!pump(s->up, s->client, s->upstream, bytes_up) || !pump(s->down, s->upstream, s->client, bytes_down))
+	{
+		close_session(s);
+		return;
+	}
+	if (s->up.done && s->down.done) close_session(s);
+}
+
+void accept_all(int listenfd)
+{
+	while (true)
+	{
+		struct sockaddr_in client_address;
+		socklen_t client_addrlength = sizeof(client_address);
+		int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+		if (connfd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) printf("accept error: %d\n", errno);
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (connfd >= MAX_FD)
+		{
+			close(connfd);
+			continue;
+		}
+		session* s = new session;
+		s->client = connfd;
+		s->upstream = -1;
+		s->up.pipe_r = s->up.pipe_w = s->down.pipe_r = s->down.pipe_w = -1;
+		s->next_upstream = round_robin;
+		round_robin = (round_robin + 1) % upstream_count;
+		s->tries = 0;
+		sessions[connfd] = s;
+		++session_count;
+		addfd(epollfd, connfd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+		if (!open_flow(s->up) || !open_flow(s->down) || !connect_upstream(s))
+		{
+			close_session(s);
+			continue;
+		}
+		if (!s->connecting) handle_session(s, s->upstream, 0);
+	}
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc <= 3)
+	{
+		printf("usage: %s ip port upstream_ip:port [upstream_ip:port ...]\n", basename(argv[0]));
+		return 1;
+	}
+	const char* ip = argv[1];
+	int port = atoi(argv[2]);
+	for (int i = 3; i < argc && upstream_count < MAX_UPSTREAM; ++i)
+	{
+		if (!parse_address(argv[i], upstreams[upstream_count]))
+		{
+			printf("bad upstream address: %s\n", argv[i]);
+			return 1;
+		}
+		++upstream_count;
+	}
+
+	int ret = 0;
+	struct sockaddr_in address;
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	inet_pton(AF_INET, ip, &address.sin_addr);
+	address.sin_port = htons(port);
+
+	int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+	assert(listenfd >= 0);
+	int reuse = 1;
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
+	assert(ret != -1);
+	ret = listen(listenfd, SOMAXCONN);
+	assert(ret != -1);
+
+	/* 对方已经关闭时splice写socket会产生SIGPIPE，忽略它，由splice返回EPIPE */
+	signal(SIGPIPE, SIG_IGN);
+
+	epoll_event events[MAX_EVENT_NUMBER];
+	epollfd = epoll_create(5);
+	assert(epollfd != -1);
+	addfd(epollfd, listenfd, EPOLLIN);
+
+	ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
+	assert(ret != -1);
+	setnonblocking(pipefd[1]);
+	addfd(epollfd, pipefd[0], EPOLLIN);
+	addsig(SIGTERM);
+	addsig(SIGUSR1);
+	bool stop_server = false;
+	sessions = new session*[MAX_FD]();
+
+	while (!stop_server)
+	{
+		int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+		if ((number < 0) && (errno != EINTR))
+		{
+			printf("epoll failure\n");
+			break;
+		}
+		for (int i = 0; i < number; ++i)
+		{
+			int sockfd = events[i].data.fd;
+			if (sockfd == listenfd)
+			{
+				accept_all(listenfd);
+			}
+			else if (sockfd == pipefd[0])
+			{
+				char signals[1024];
+				ret = recv(pipefd[0], signals, sizeof(signals), 0);
+				for (int k = 0; k < ret; ++k)
+				{
+					if (signals[k] == SIGTERM)
+					{
+						stop_server = true;
+					}
+					else if (signals[k] == SIGUSR1)
+					{
+						printf("%d sessions, %llu bytes up, %llu bytes down\n", session_count, bytes_up, bytes_down);
+					}
+				}
+			}
+			else if (sessions[sockfd])
+			{
+				/* 同一轮中会话可能已经被前面的事件关闭 */
+				handle_session(sessions[sockfd], sockfd, events[i].events);
+			}
+		}
+	}
+
+	for (int fd = 0; fd < MAX_FD; ++fd)
+	{
+		if (sessions[fd]) close_session(sessions[fd]);
+	}
+	close(listenfd);
+	close(pipefd[1]);
+	close(pipefd[0]);
+	close(epollfd);
+	printf("%llu bytes up, %llu bytes down\n", bytes_up, bytes_down);
+	delete [] sessions;
+	return 0;
+}
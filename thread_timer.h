@@ -0,0 +1,199 @@
+#ifndef THREAD_TIMER
+#define THREAD_TIMER
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+#include "hier_time_wheel.h"
+#include "mpsc_queue.h"
+
+/**
+ * 每个事件循环线程一个定时器
+ * 定时器只由所属线程直接操作（添加、tick、回调），因此不需要任何锁；
+ * 其他线程要取消或重新设定定时器时，把消息放入无锁的MPSC队列，
+ * 所属线程在每次tick开始时先取出并执行这些消息
+ * 队列满时消息放入加锁的溢出链表，不会丢失；溢出链表非空期间的消息都走溢出链表，保持每个线程发出的顺序
+ * 句柄中带有代号，定时器到期或被删除后节点代号清零，迟到的消息会被忽略
+ */
+
+class loop_timer;
+
+struct timer_handle
+{
+	loop_timer* owner; // 定时器所属的事件循环
+	hw_timer* timer;
+	uint64_t seq;      // 创建时的代号
+};
+
+class loop_timer
+{
+public:
+	/* 必须在所属的事件循环线程中构造，queue_size必须是2的幂 */
+	loop_timer(size_t queue_size = 4096, timer_clock* clk = NULL): owner_thread(pthread_self()), next_seq(1), wheel(clk), queue(queue_size),
+		overflow_pending(0), overflowed(0)
+	{
+		pthread_mutex_init(&overflow_lock, NULL);
+	}
+	~loop_timer()
+	{
+		pthread_mutex_destroy(&overflow_lock);
+	}
+
+	/* 添加定时器，只能在所属线程中调用 */
+	timer_handle add_timer(int timeout, void (*cb_func)(client_data*), client_data* user_data)
+	{
+		timer_handle h = {this, NULL, 0};
+		hw_timer* timer = wheel.add_timer(timeout);
+		if (!timer) return h;
+		timer->cb_func = cb_func;
+		timer->user_data = user_data;
+		timer->seq = next_seq++;
+		h.timer = timer;
+		h.seq = timer->seq;
+		return h;
+	}
+
+	/* 取消定时器，任意线程都可以调用；句柄无效时返回false */
+	bool del_timer(const timer_handle& h)
+	{
+		return post(h, TIMER_CANCEL, 0);
+	}
+
+	/* 把定时器改为从现在起timeout毫秒后到期，任意线程都可以调用 */
+	bool reschedule(const timer_handle& h, int timeout)
+	{
+		return post(h, TIMER_RESCHEDULE, timeout);
+	}
+
+	/* 先处理其他线程发来的消息，再推进时间轮 */
+	void tick()
+	{
+		drain();
+		wheel.tick();
+	}
+
+	/* 执行队列和溢出链表中的全部消息，返回处理的条数 */
+	int drain()
+	{
+		timer_msg msg;
+		int count = 0;
+		while (queue.pop(msg))
+		{
+			apply(msg);
+			++count;
+		}
+		if (!__atomic_load_n(&overflow_pending, __ATOMIC_ACQUIRE)) return count;
+		std::vector<timer_msg> msgs;
+		pthread_mutex_lock(&overflow_lock);
+		/* 进入溢出链表之前放入队列的消息更早，先执行它们 */
+		while (queue.pop(msg))
+		{
+			apply(msg);
+			++count;
+		}
+		msgs.swap(overflow);
+		__atomic_store_n(&overflow_pending, 0, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&overflow_lock);
+		for (size_t i = 0; i < msgs.size(); ++i)
+		{
+			apply(msgs[i]);
+		}
+		return count + msgs.size();
+	}
+
+	/* 设置每次tick执行回调的预算，只能在所属线程中调用 */
+	void set_budget(int max_count, uint64_t max_ns)
+	{
+		wheel.set_budget(max_count, max_ns);
+	}
+
+	/* 是否还有因为预算用完而推迟执行的回调，有的话事件循环应尽快再次tick */
+	bool has_pending() const
+	{
+		return wheel.has_pending();
+	}
+
+	/* 只应在所属线程中读取 */
+	const timer_stats& get_stats() const
+	{
+		return wheel.get_stats();
+	}
+
+	bool in_owner_thread() const
+	{
+		return pthread_equal(owner_thread, pthread_self());
+	}
+
+	/* 因为队列满而放入溢出链表的消息数 */
+	uint64_t overflow_messages() const
+	{
+		return __atomic_load_n(&overflowed, __ATOMIC_RELAXED);
+	}
+
+private:
+	loop_timer(const loop_timer&);
+	loop_timer& operator=(const loop_timer&);
+
+	enum TIMER_OP
+	{
+		TIMER_CANCEL = 0,
+		TIMER_RESCHEDULE
+	};
+
+	struct timer_msg
+	{
+		TIMER_OP op;
+		int timeout;
+		hw_timer* timer;
+		uint64_t seq;
+	};
+
+	bool post(const timer_handle& h, TIMER_OP op, int timeout)
+	{
+		if (!h.timer) return false;
+		timer_msg msg;
+		msg.op = op;
+		msg.timeout = timeout;
+		msg.timer = h.timer;
+		msg.seq = h.seq;
+		if (in_owner_thread())
+		{
+			/* 所属线程自己操作，直接执行 */
+			apply(msg);
+			return true;
+		}
+		if (!__atomic_load_n(&overflow_pending, __ATOMIC_ACQUIRE) && queue.push(msg)) return true;
+		pthread_mutex_lock(&overflow_lock);
+		overflow.push_back(msg);
+		__atomic_store_n(&overflow_pending, 1, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&overflowed, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&overflow_lock);
+		return true;
+	}
+
+	void apply(const timer_msg& msg)
+	{
+		/* 代号不一致说明定时器已经到期或被删除（节点可能已被复用） */
+		if (msg.timer->seq != msg.seq) return;
+		if (msg.op == TIMER_CANCEL)
+		{
+			wheel.del_timer(msg.timer);
+		}
+		else
+		{
+			wheel.adjust_timer(msg.timer, msg.timeout);
+		}
+	}
+
+private:
+	pthread_t owner_thread;      // 所属的事件循环线程
+	uint64_t next_seq;           // 下一个代号，从1开始，0表示节点空闲
+	hier_time_wheel wheel;
+	mpsc_queue<timer_msg> queue; // 其他线程发来的取消/重新设定消息
+	pthread_mutex_t overflow_lock;
+	std::vector<timer_msg> overflow; // 队列满时的消息，由overflow_lock保护
+	int overflow_pending;            // overflow非空
+	uint64_t overflowed;
+};
+
+#endif
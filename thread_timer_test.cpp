@@ -0,0 +1,145 @@
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include "lst_timer.h"
+#include "thread_timer.h"
+#include "timer_clock.h"
+
+/**
+ * loop_timer的跨线程测试
+ * 用法: thread_timer_test [timers] [threads]
+ * 所属线程添加一批定时器，多个线程同时发送取消和重新设定的消息，所属线程一边drain一边接收；
+ * 消息队列故意设得很小，大部分消息经过溢出链表
+ * 使用虚拟时钟，发送期间时间不前进，结束后快进到所有定时器到期，检查：
+ *   被取消的定时器（包括先重新设定再取消的）不会触发
+ *   连续两次重新设定的定时器按后一次的时间触发，即同一线程的消息没有乱序
+ *   其余定时器按原来的时间触发，每个定时器最多触发一次
+ */
+
+#define QUEUE_SIZE 16     // 消息队列的容量，很小以便触发溢出
+#define BASE_TIMEOUT 1000 // 原始超时(ms)
+#define FIRST_TIMEOUT 2000
+#define SECOND_TIMEOUT 4000
+
+enum TEST_OP
+{
+	OP_CANCEL = 0,        // 取消
+	OP_RESCHEDULE_CANCEL, // 重新设定后取消
+	OP_RESCHEDULE_TWICE,  // 连续两次重新设定
+	OP_NONE,              // 不发送消息
+	OP_COUNT
+};
+
+static virtual_clock vclock;
+static std::vector<client_data> users;   // sockfd保存定时器编号
+static std::vector<timer_handle> handles;
+static std::vector<int> fired;           // 触发次数
+static std::vector<uint64_t> fired_at;   // 触发的虚拟时刻
+static int thread_count = 4;
+static int workers_done = 0;
+
+void test_cb(client_data* user_data)
+{
+	int id = user_data->sockfd;
+	++fired[id];
+	fired_at[id] = vclock.now_ms();
+}
+
+static void* worker(void* arg)
+{
+	int w = (int)(intptr_t)arg;
+	for (size_t i = w; i < handles.size(); i += thread_count)
+	{
+		const timer_handle& h = handles[i];
+		switch (i % OP_COUNT)
+		{
+			case OP_CANCEL:
+				h.owner->del_timer(h);
+				break;
+			case OP_RESCHEDULE_CANCEL:
+				h.owner->reschedule(h, FIRST_TIMEOUT);
+				h.owner->del_timer(h);
+				break;
+			case OP_RESCHEDULE_TWICE:
+				h.owner->reschedule(h, FIRST_TIMEOUT);
+				h.owner->reschedule(h, SECOND_TIMEOUT);
+				break;
+			default:
+				break;
+		}
+	}
+	__atomic_add_fetch(&workers_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+int main(int argc, char const *argv[])
+{
+	int n = argc > 1 ? atoi(argv[1]) : 100000;
+	if (argc > 2) thread_count = atoi(argv[2]);
+	if (n <= 0 || thread_count <= 0)
+	{
+		printf("usage: %s [timers] [threads]\n", argv[0]);
+		return 1;
+	}
+
+	loop_timer timers(QUEUE_SIZE, &vclock);
+	users.resize(n);
+	handles.resize(n);
+	fired.assign(n, 0);
+	fired_at.assign(n, 0);
+	for (int i = 0; i < n; ++i)
+	{
+		users[i].sockfd = i;
+		handles[i] = timers.add_timer(BASE_TIMEOUT, test_cb, &users[i]);
+	}
+
+	std::vector<pthread_t> threads(thread_count);
+	for (int w = 0; w < thread_count; ++w)
+	{
+		pthread_create(&threads[w], NULL, worker, (void*)(intptr_t)w);
+	}
+	/* 发送期间所属线程不断地处理消息，时间不前进，不会有定时器到期 */
+	int drained = 0;
+	while (__atomic_load_n(&workers_done, __ATOMIC_ACQUIRE) < thread_count)
+	{
+		drained += timers.drain();
+	}
+	for (int w = 0; w < thread_count; ++w)
+	{
+		pthread_join(threads[w], NULL);
+	}
+	drained += timers.drain();
+
+	while (vclock.now_ms() <= SECOND_TIMEOUT)
+	{
+		vclock.advance(10);
+		timers.tick();
+	}
+	while (timers.has_pending()) timers.tick();
+
+	int failures = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		int op = i % OP_COUNT;
+		bool ok;
+		if (op == OP_CANCEL || op == OP_RESCHEDULE_CANCEL) ok = fired[i] == 0;
+		else if (op == OP_RESCHEDULE_TWICE) ok = fired[i] == 1 && fired_at[i] >= SECOND_TIMEOUT;
+		else ok = fired[i] == 1 && fired_at[i] < FIRST_TIMEOUT;
+		if (!ok)
+		{
+			if (failures < 10)
+			{
+				printf("timer %d (op %d): fired %d times, at %llu ms\n", i, op, fired[i], (unsigned long long)fired_at[i]);
+			}
+			++failures;
+		}
+	}
+	printf("%d timers, %d threads, %d messages, %llu overflowed, %d failures\n", n, thread_count, drained,
+		(unsigned long long)timers.overflow_messages(), failures);
+	return failures == 0 ? 0 : 1;
+}
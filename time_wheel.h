@@ -4,59 +4,75 @@
 #include <time.h>
 #include <netinet/in.h>
 #include <stdio.h>
+#include "timer_pool.h"
+#include "timer_clock.h"
+#include "timer_stats.h"
+#include "timer_batch.h"
 
-#define BUFFER_SIZE 64
-class tw_time;
-struct client_data
-{
-	sockaddr_in address;
-	int sockfd;
-	char buf[BUFFER_SIZE];
-	tw_timer* timer;
-};
+/* 定义TIMER_DEBUG后打印定时器的调试信息 */
+#ifndef TIMER_TRACE
+#ifdef TIMER_DEBUG
+#define TIMER_TRACE(...) printf(__VA_ARGS__)
+#else
+#define TIMER_TRACE(...)
+#endif
+#endif
+
+/* client_data由使用者定义（例如lst_timer.h中的定义），时间轮只保存它的指针，
+   这样时间轮可以和其他定时器容器一起使用 */
+struct client_data;
 
-class tw_timer
+/* 节点以负载类型和回调类型为模板参数，默认的tw_timer回调为void(*)(client_data*) */
+template<typename T = client_data, typename Callback = void (*)(T*)>
+class basic_tw_timer
 {
 public:
-	tw_timer(int rot, int ts): next(NULL), prev(NULL), rotation(rot), time_slot(ts){}
+	typedef T data_type;
+	basic_tw_timer(int rot, int ts): rotation(rot), time_slot(ts), expire(0), pending(false), cb_func(), user_data(NULL), next(NULL), prev(NULL){}
 
 	int rotation;  /* 记录定时器在时间轮多少圈后生效 */
 	int time_slot; /* 记录定时器在时间轮上哪个槽 */
-	void (*cb_func)(client_data); /* 定时器回调函数 */
-	client_data* user_data;
+	uint64_t expire; /* 应当到期的时刻（毫秒），用于统计迟到时间 */
+	bool pending;    /* 已经到期，等待执行回调 */
+	Callback cb_func; /* 定时器回调函数 */
+	T* user_data;
 
-	tw_timer* next;
-	tw_timer* prev;
+	basic_tw_timer* next;
+	basic_tw_timer* prev;
 };
+typedef basic_tw_timer<> tw_timer;
 
-class time_wheel
+template<typename Timer = tw_timer>
+class basic_time_wheel
 {
 public:
-	time_wheel(): cur_slot(0)
+	basic_time_wheel(timer_clock* clk = NULL): cur_slot(0), clock(clk ? clk : real_clock::monotonic())
 	{
+		last_tick = clock->now_ms();
 		for (int i = 0; i < N; ++i)
 		{
 			slots[i] = NULL;
 		}
 	}
-	~time_wheel()
+	~basic_time_wheel()
 	{
 		for (int i = 0; i < N; ++i)
 		{
-			tw_timer* tmp = tmp->next;
+			Timer* tmp = slots[i];
 			while(tmp)
 			{
 				slots[i] = tmp->next;
-				delete tmp;
+				timer_pool<Timer>::destroy(tmp);
 				tmp = slots[i];
 			}
 		}
+		expired.clear(release);
 	}
 
 	/* 根据定时值timeout创建一个定时器，并把它插入合适的槽中 */
-	tw_timer* add_timer(int timeout)
+	Timer* add_timer(int timeout)
 	{
-		if (timeout < 0) NULL;
+		if (timeout < 0) return NULL;
 		int ticks = 0;
 		/* 根据超时参数计算它将在时间轮转动多少个嘀嗒后被触发，并将该嘀嗒数存放在ticks变量中 */
 		if (timeout < SI) ticks = 1; // 小于槽间隔SI，向上折合1
@@ -64,10 +80,12 @@ public:
 
 		int rotation = ticks / N;               // 多少圈后被触发
 		int ts = (cur_slot + (ticks % N)) % N;  // 应该插入那个槽中
-		tw_timer* timer = new tw_timer(rotation, ts);
+		Timer* timer = timer_pool<Timer>::create(rotation, ts);
+		timer->expire = clock->now_ms() + (uint64_t)ticks * SI * 1000;
+		stats.on_add();
 		if (!slots[ts])
 		{
-			printf("add timer, rotation is %d, ts is %d, cur_slot is %d\n", rotation, ts, cur_slot);
+			TIMER_TRACE("add timer, rotation is %d, ts is %d, cur_slot is %d\n", rotation, ts, cur_slot);
 			slots[ts] = timer;
 		}
 		else
@@ -80,33 +98,69 @@ public:
 	}
 
 	/* 删除目标定时器 */
-	void del_timer(tw_timer* timer)
+	void del_timer(Timer* timer)
 	{
 		if (!timer) return;
+		stats.on_del();
+		if (timer->pending)
+		{
+			expired.remove(timer);
+			timer_pool<Timer>::destroy(timer);
+			return;
+		}
 		int ts = timer->time_slot;
 		if (timer == slots[ts])
 		{
 			/* 如果是槽的头节点 */
 			slots[ts] = slots[ts]->next;
 			if (slots[ts]) slots[ts]->prev = NULL;
-			delete timer;
+			timer_pool<Timer>::destroy(timer);
 		}
 		else
 		{
 			timer->prev->next = timer->next;
 			if (timer->next) timer->next->prev = timer->prev;
-			delete timer;
+			timer_pool<Timer>::destroy(timer);
 		}
 	}
 
-	/* 时间间隔SI到之后，调用该函数，时间轮向前滚动一个槽的间隔 */
+	/* 按时钟走过的时间转动时间轮，每过SI秒tick一次，返回转过的槽数
+	   调用者不必严格每SI秒调用一次，虚拟时钟下也可以一次快进很多槽 */
+	int update()
+	{
+		uint64_t now = clock->now_ms();
+		int n = 0;
+		while (now - last_tick >= SI * 1000)
+		{
+			last_tick += SI * 1000;
+			tick();
+			++n;
+		}
+		return n;
+	}
+
+	const timer_stats& get_stats() const { return stats; }
+
+	/* 设置每次tick执行回调的预算，0表示不限制 */
+	void set_budget(int max_count, uint64_t max_ns)
+	{
+		budget.max_count = max_count;
+		budget.max_ns = max_ns;
+	}
+
+	/* 是否还有已经到期、因为预算用完而没有执行的定时器 */
+	bool has_pending() const { return !expired.empty(); }
+
+	/* 时间间隔SI到之后，调用该函数，时间轮向前滚动一个槽的间隔
+	   当前槽中到期的定时器先摘到待执行队列，再在预算内执行回调 */
 	void tick()
 	{
-		tw_timer* tmp = slots[cur_slot];
-		printf("current slot is %d\n", cur_slot);
+		uint64_t now = clock->now_ms();
+		Timer* tmp = slots[cur_slot];
+		TIMER_TRACE("current slot is %d\n", cur_slot);
 		while(tmp)
 		{
-			printf("tick the timer once\n");
+			TIMER_TRACE("tick the timer once\n");
 			if (tmp->rotation > 0)
 			{
 				/* 这一轮还不到触发时间 */
@@ -115,34 +169,46 @@ public:
 			}
 			else
 			{
-				/* 否则，定时器以及到期，执行定时任务，然后删除 */
-				tmp->cb_func(tmp->user_data);
+				/* 否则，定时器已经到期，从槽中摘下放入待执行队列 */
+				Timer* tmp2 = tmp->next;
 				if (tmp == slots[cur_slot])
 				{
-					printf("delete header in cur_slot\n");
-					slots[cur_slot] = tmp->next;
-					delete tmp;
+					TIMER_TRACE("delete header in cur_slot\n");
+					slots[cur_slot] = tmp2;
 					if(slots[cur_slot]) slots[cur_slot]->prev = NULL;
-					tmp = slots[cur_slot];
 				}
 				else
 				{
-					tmp->prev->next = tmp->next;
-					if (tmp->next) tmp->next->prev = tmp->prev;
-					tw_timer* tmp2 = tmp->next;
-					delete tmp;
-					tmp = tmp2;
+					tmp->prev->next = tmp2;
+					if (tmp2) tmp2->prev = tmp->prev;
 				}
+				expired.push(tmp);
+				tmp = tmp2;
 			}
 		}
-		cur_slot = ++cur_slot % N; // 更新当前时间轮的槽
+		cur_slot = (cur_slot + 1) % N; // 更新当前时间轮的槽
+		/* 不按时钟调用tick时可能提前，迟到时间记为0 */
+		stats.on_tick(expired.dispatch(budget, now, 1, stats, release));
+	}
+
+private:
+	static void release(Timer* timer)
+	{
+		timer_pool<Timer>::destroy(timer);
 	}
 
 private:
 	static const int N = 60; // 槽的总数
 	static const int SI = 1; // 转动间隔 1 S
-	tw_timer* slots[N];
+	Timer* slots[N];
 	int cur_slot;            // 时间轮当前槽
-}
+	timer_clock* clock;
+	uint64_t last_tick;      // 上一次转动的时刻（毫秒）
+	timer_stats stats;
+	timer_batch<Timer> expired; // 已经到期、等待执行回调的定时器
+	timer_budget budget;
+};
+
+typedef basic_time_wheel<> time_wheel;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#ifndef TIMER_BATCH
+#define TIMER_BATCH
+
+#include <stddef.h>
+#include <stdint.h>
+#include "timer_stats.h"
+
+/**
+ * 到期定时器的批量派发
+ * tick先把到期的定时器从容器中摘下，按到期顺序放入一个侵入式的待执行队列（复用节点的prev/next），
+ * 再在预算内依次执行回调；预算用完时剩下的定时器留在队列中，下一次tick继续执行
+ * 这样大量连接同时超时的时候，一次tick不会长时间占用事件循环
+ */
+
+/* 每次tick派发回调的预算，0表示不限制 */
+struct timer_budget
+{
+	int max_count;   // 最多执行多少个回调
+	uint64_t max_ns; // 最多执行多长时间
+	timer_budget(): max_count(0), max_ns(0) {}
+};
+
+template<typename Timer>
+class timer_batch
+{
+public:
+	timer_batch(): head(NULL), tail(NULL), count(0) {}
+
+	bool empty() const { return head == NULL; }
+	size_t size() const { return count; }
+
+	/* 追加到队尾 */
+	void push(Timer* timer)
+	{
+		timer->pending = true;
+		timer->next = NULL;
+		timer->prev = tail;
+		if (tail) tail->next = timer;
+		else head = timer;
+		tail = timer;
+		++count;
+	}
+
+	/* 从队列中取出一个还没执行的定时器（被删除或者被调整） */
+	void remove(Timer* timer)
+	{
+		if (timer->prev) timer->prev->next = timer->next;
+		else head = timer->next;
+		if (timer->next) timer->next->prev = timer->prev;
+		else tail = timer->prev;
+		timer->prev = timer->next = NULL;
+		timer->pending = false;
+		--count;
+	}
+
+	Timer* pop()
+	{
+		Timer* timer = head;
+		if (timer) remove(timer);
+		return timer;
+	}
+
+	/**
+	 * 在预算内依次执行回调并回收节点，返回执行的个数
+	 * @param now_ms   开始派发时的当前时间（毫秒），加上已经用掉的时间就是每个回调执行时的时间，用于统计迟到时间
+	 * @param scale    节点expire换算成毫秒的倍数（秒级容器为1000）
+	 * @param release  回收节点的函数
+	 */
+	int dispatch(const timer_budget& budget, uint64_t now_ms, uint64_t scale, timer_stats& stats, void (*release)(Timer*))
+	{
+		int n = 0;
+		uint64_t start = timer_stats::now_ns();
+		uint64_t last = start;
+		while (head)
+		{
+			if (budget.max_count > 0 && n >= budget.max_count) break;
+			if (budget.max_ns > 0 && last - start >= budget.max_ns) break;
+			Timer* timer = pop();
+			uint64_t expire = (uint64_t)timer->expire * scale;
+			/* 前面的回调执行得越久，后面的回调就越迟，复用上一次读的时钟，不额外读时钟 */
+			uint64_t fire_ms = now_ms + (last - start) / 1000000;
+			timer->cb_func(timer->user_data);
+			/* 相邻两次读时钟的差就是这个回调的执行时间 */
+			uint64_t end = timer_stats::now_ns();
+			stats.on_expire(fire_ms > expire ? fire_ms - expire : 0, end - last);
+			last = end;
+			release(timer);
+			++n;
+		}
+		return n;
+	}
+
+	/* 回收所有未执行的节点，不执行回调 */
+	void clear(void (*release)(Timer*))
+	{
+		Timer* timer;
+		while ((timer = pop()) != NULL)
+		{
+			release(timer);
+		}
+	}
+
+private:
+	Timer* head;
+	Timer* tail;
+	size_t count;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "lst_timer.h"
+#include "heap_timer.h"
+#include "time_wheel.h"
+#include "hier_time_wheel.h"
+
+/**
+ * 定时器容器基准测试
+ * 用法: timer_bench [max_timers] [list_max]
+ * 对sort_timer_lst、time_heap、time_wheel、hier_time_wheel分别运行以下负载，
+ * 定时器数量从1万开始每次乘10，直到max_timers（默认100万，最大可到1000万）：
+ *   insert  : 连接风暴，连续添加N个随机超时的定时器
+ *   cancel  : 在N个存活定时器的背景下，添加一个短超时定时器后立即删除（短请求）
+ *   adjust  : keep-alive，随机挑选存活的定时器延长超时
+ *   expire  : N个定时器在同一时刻到期，一次tick全部处理
+ *   tick    : N个定时器在3秒内陆续到期，每毫秒tick一次，统计每次tick耗时的分位数
+ *             （time_wheel分布在60个槽上，连续tick不等待真实时间）
+ * time_heap<fn>和hier_wheel<fn>使用函数对象回调（内联）代替函数指针
+ * sort_timer_lst的添加和调整是O(n)的，超过list_max（默认2万）个定时器时跳过
+ */
+
+#define TICK_SPREAD_MS 3000 // tick负载中定时器到期时间的分布范围
+
+static uint64_t expired_count = 0;
+
+void bench_cb(client_data*)
+{
+	++expired_count;
+}
+
+/* 函数对象形式的回调，存放在节点中，到期时可以被内联 */
+struct bench_handler
+{
+	void operator()(client_data*) { ++expired_count; }
+};
+typedef basic_util_timer<client_data, bench_handler> inline_util_timer;
+typedef basic_hw_timer<client_data, bench_handler> inline_hw_timer;
+
+/* 函数指针需要设置，函数对象默认构造即可 */
+static void set_cb(void (*&cb_func)(client_data*)) { cb_func = bench_cb; }
+static void set_cb(bench_handler&) {}
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rand_state = 88172645463325252ULL;
+static uint64_t xorshift()
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return rand_state;
+}
+
+/**
+ * 各个容器的适配器，统一为毫秒超时的 add/del/adjust/tick 接口
+ * sort_timer_lst和time_heap以秒为单位，time_wheel的槽间隔是1秒
+ */
+struct lst_adapter
+{
+	typedef util_timer node;
+	static const char* name() { return "sort_timer_lst"; }
+	sort_timer_lst c;
+	node* add(int timeout_ms)
+	{
+		node* timer = timer_pool<util_timer>::create();
+		timer->expire = time(NULL) + timeout_ms / 1000;
+		timer->cb_func = bench_cb;
+		timer->user_data = NULL;
+		c.add_timer(timer);
+		return timer;
+	}
+	void del(node* timer) { c.del_timer(timer); }
+	node* adjust(node* timer, int timeout_ms)
+	{
+		time_t expire = time(NULL) + timeout_ms / 1000;
+		if (expire < timer->expire) expire = timer->expire; // adjust_timer只支持延长
+		timer->expire = expire;
+		c.adjust_timer(timer);
+		return timer;
+	}
+	void tick() { c.tick(); }
+	size_t memory() const { return sizeof(c); }
+};
+
+template<typename Timer>
+struct basic_heap_adapter
+{
+	typedef Timer node;
+	static const char* name();
+	basic_time_heap<Timer> c;
+	node* add(int timeout_ms)
+	{
+		node* timer = timer_pool<Timer>::create();
+		timer->expire = time(NULL) + timeout_ms / 1000;
+		set_cb(timer->cb_func);
+		timer->user_data = NULL;
+		c.add_timer(timer);
+		return timer;
+	}
+	void del(node* timer) { c.del_timer(timer); }
+	node* adjust(node* timer, int timeout_ms)
+	{
+		timer->expire = time(NULL) + timeout_ms / 1000;
+		c.adjust_timer(timer);
+		return timer;
+	}
+	void tick() { c.tick(); }
+	size_t memory() const { return c.memory_usage(); }
+};
+typedef basic_heap_adapter<util_timer> heap_adapter;
+typedef basic_heap_adapter<inline_util_timer> heap_inline_adapter;
+template<> const char* heap_adapter::name() { return "time_heap"; }
+template<> const char* heap_inline_adapter::name() { return "time_heap<fn>"; }
+
+struct tw_adapter
+{
+	typedef tw_timer node;
+	static const char* name() { return "time_wheel"; }
+	time_wheel c;
+	node* add(int timeout_ms)
+	{
+		node* timer = c.add_timer(timeout_ms / 1000);
+		timer->cb_func = bench_cb;
+		timer->user_data = NULL;
+		return timer;
+	}
+	void del(node* timer) { c.del_timer(timer); }
+	node* adjust(node* timer, int timeout_ms)
+	{
+		/* 时间轮没有调整接口，删除后重新添加 */
+		c.del_timer(timer);
+		return add(timeout_ms);
+	}
+	void tick() { c.tick(); }
+	size_t memory() const { return sizeof(c); }
+};
+
+template<typename Timer>
+struct basic_hw_adapter
+{
+	typedef Timer node;
+	static const char* name();
+	basic_hier_time_wheel<Timer> c;
+	node* add(int timeout_ms)
+	{
+		node* timer = c.add_timer(timeout_ms);
+		set_cb(timer->cb_func);
+		timer->user_data = NULL;
+		return timer;
+	}
+	void del(node* timer) { c.del_timer(timer); }
+	node* adjust(node* timer, int timeout_ms)
+	{
+		c.adjust_timer(timer, timeout_ms);
+		return timer;
+	}
+	void tick() { c.tick(); }
+	size_t memory() const { return sizeof(c); }
+};
+typedef basic_hw_adapter<hw_timer> hw_adapter;
+typedef basic_hw_adapter<inline_hw_timer> hw_inline_adapter;
+template<> const char* hw_adapter::name() { return "hier_time_wheel"; }
+template<> const char* hw_inline_adapter::name() { return "hier_wheel<fn>"; }
+
+/* 长超时：1小时到2小时之间，保证在测试期间不会到期 */
+static int long_timeout()
+{
+	return 3600 * 1000 + xorshift() % (3600 * 1000);
+}
+
+static void report(const char* container, const char* workload, size_t n, uint64_t ns, size_t ops)
+{
+	printf("%-16s %-8s n=%-9zu %10.1f ns/op\n", container, workload, n, (double)ns / ops);
+}
+
+static uint64_t percentile(std::vector<uint64_t>& samples, double p)
+{
+	if (samples.empty()) return 0;
+	size_t idx = (size_t)(p * (samples.size() - 1));
+	return samples[idx];
+}
+
+template<typename A>
+void bench_insert_cancel_adjust(size_t n)
+{
+	A* a = new A;
+	std::vector<typename A::node*> timers(n);
+
+	/* 连接风暴 */
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < n; ++i)
+	{
+		timers[i] = a->add(long_timeout());
+	}
+	report(A::name(), "insert", n, now_ns() - start, n);
+	size_t node_bytes = sizeof(typename A::node);
+	printf("%-16s %-8s n=%-9zu %10.1f bytes/timer\n", A::name(), "memory", n,
+		(double)(node_bytes * n + a->memory()) / n);
+
+	/* 短请求：添加后立即取消 */
+	start = now_ns();
+	for (size_t i = 0; i < n; ++i)
+	{
+		a->del(a->add(1000 + xorshift() % 29000));
+	}
+	report(A::name(), "cancel", n, now_ns() - start, n);
+
+	/* keep-alive：随机延长存活的定时器 */
+	start = now_ns();
+	for (size_t i = 0; i < n; ++i)
+	{
+		size_t k = xorshift() % n;
+		timers[k] = a->adjust(timers[k], long_timeout());
+	}
+	report(A::name(), "adjust", n, now_ns() - start, n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		a->del(timers[i]);
+	}
+	delete a;
+}
+
+template<typename A>
+void bench_mass_expire(size_t n)
+{
+	A* a = new A;
+	/* 1ms的超时对于秒级容器意味着“立即到期”，时间轮则落在下一个槽 */
+	for (size_t i = 0; i < n; ++i)
+	{
+		a->add(1);
+	}
+	usleep(2000);
+	expired_count = 0;
+	uint64_t start = now_ns();
+	/* time_wheel第一次tick只处理当前槽，定时器在下一个槽中 */
+	for (int tries = 0; tries < 3 && expired_count < n; ++tries)
+	{
+		a->tick();
+	}
+	uint64_t ns = now_ns() - start;
+	if (expired_count != n)
+	{
+		printf("%-16s expire   n=%-9zu only %llu timers expired\n", A::name(), n, (unsigned long long)expired_count);
+	}
+	report(A::name(), "expire", n, ns, n);
+	delete a;
+}
+
+template<typename A>
+void bench_tick(size_t n, bool virtual_ticks)
+{
+	A* a = new A;
+	/* time_wheel每次tick转动一个槽（1秒），让定时器分布在一整圈上 */
+	int spread = virtual_ticks ? 60000 : TICK_SPREAD_MS;
+	for (size_t i = 0; i < n; ++i)
+	{
+		a->add(1000 + xorshift() % spread);
+	}
+	expired_count = 0;
+	std::vector<uint64_t> samples;
+	uint64_t deadline = now_ns() + (uint64_t)(TICK_SPREAD_MS + 1500) * 1000000;
+	while (expired_count < n && now_ns() < deadline)
+	{
+		uint64_t start = now_ns();
+		a->tick();
+		samples.push_back(now_ns() - start);
+		/* time_wheel每次tick转动一个槽，不需要等待真实时间 */
+		if (!virtual_ticks) usleep(1000);
+	}
+	std::sort(samples.begin(), samples.end());
+	printf("%-16s %-8s n=%-9zu ticks %-6zu p50 %8llu ns  p99 %10llu ns  p99.9 %10llu ns  max %10llu ns\n",
+		A::name(), "tick", n, samples.size(),
+		(unsigned long long)percentile(samples, 0.5), (unsigned long long)percentile(samples, 0.99),
+		(unsigned long long)percentile(samples, 0.999), (unsigned long long)samples.back());
+	delete a;
+}
+
+template<typename A>
+void bench_all(size_t n, bool virtual_ticks)
+{
+	bench_insert_cancel_adjust<A>(n);
+	bench_mass_expire<A>(n);
+	bench_tick<A>(n, virtual_ticks);
+}
+
+int main(int argc, char const *argv[])
+{
+	size_t max_timers = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	size_t list_max = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+	if (max_timers < 10000) max_timers = 10000;
+
+	for (size_t n = 10000; n <= max_timers; n *= 10)
+	{
+		printf("==== %zu timers ====\n", n);
+		if (n <= list_max) bench_all<lst_adapter>(n, false);
+		else printf("%-16s skipped (n > list_max %zu)\n", lst_adapter::name(), list_max);
+		bench_all<heap_adapter>(n, false);
+		bench_all<heap_inline_adapter>(n, false);
+		bench_all<tw_adapter>(n, true);
+		bench_all<hw_adapter>(n, false);
+		bench_all<hw_inline_adapter>(n, false);
+		fflush(stdout);
+	}
+
+	timer_pool<util_timer>::local().dump(stdout, "util_timer");
+	timer_pool<tw_timer>::local().dump(stdout, "tw_timer");
+	timer_pool<hw_timer>::local().dump(stdout, "hw_timer");
+	return 0;
+}
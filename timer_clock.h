@@ -0,0 +1,83 @@
+#ifndef TIMER_CLOCK
+#define TIMER_CLOCK
+
+#include <time.h>
+#include <stdint.h>
+
+/**
+ * 定时器容器使用的时钟，统一以毫秒为单位
+ * real_clock     每次都读取系统时钟
+ * coarse_clock   缓存时间，事件循环每轮调用一次update()刷新，读取没有系统调用
+ * virtual_clock  由程序推进的虚拟时间，用于快进模拟和复现定时器风暴
+ */
+class timer_clock
+{
+public:
+	virtual ~timer_clock() {}
+	virtual uint64_t now_ms() = 0;
+	time_t now_sec() { return now_ms() / 1000; }
+};
+
+class real_clock : public timer_clock
+{
+public:
+	real_clock(clockid_t id = CLOCK_MONOTONIC): clock_id(id) {}
+	uint64_t now_ms()
+	{
+		struct timespec ts;
+		clock_gettime(clock_id, &ts);
+		return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+
+	/* 墙上时间，与time(NULL)一致，sort_timer_lst和time_heap默认使用 */
+	static real_clock* wall()
+	{
+		static real_clock clock(CLOCK_REALTIME);
+		return &clock;
+	}
+	/* 单调时间，时间轮默认使用 */
+	static real_clock* monotonic()
+	{
+		static real_clock clock(CLOCK_MONOTONIC);
+		return &clock;
+	}
+
+private:
+	clockid_t clock_id;
+};
+
+class coarse_clock : public timer_clock
+{
+public:
+	/* 使用对应的*_COARSE时钟，精度为内核的一个嘀嗒 */
+	coarse_clock(bool wall = false): clock_id(wall ? CLOCK_REALTIME_COARSE : CLOCK_MONOTONIC_COARSE)
+	{
+		update();
+	}
+	void update()
+	{
+		struct timespec ts;
+		clock_gettime(clock_id, &ts);
+		cached = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+	uint64_t now_ms() { return cached; }
+
+private:
+	clockid_t clock_id;
+	uint64_t cached;
+};
+
+class virtual_clock : public timer_clock
+{
+public:
+	virtual_clock(uint64_t start = 0): current(start) {}
+	uint64_t now_ms() { return current; }
+	void set(uint64_t ms) { if (ms > current) current = ms; } // 时间只能向前
+	void advance(uint64_t ms) { current += ms; }
+	void reset(uint64_t ms) { current = ms; } // 重新开始一次模拟
+
+private:
+	uint64_t current;
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef TIMER_POOL
+#define TIMER_POOL
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <new>
+#include <utility>
+
+/**
+ * 定时器节点的对象池
+ * 以slab为单位一次性申请一批节点，空闲节点通过侵入式单链表串起来，
+ * 回收的节点直接挂回空闲链表，下一次分配时复用，稳态下不再调用malloc
+ * 每个线程有自己的一份池（thread_local），分配和回收都不需要加锁；
+ * 节点应当在分配它的线程上回收
+ */
+
+struct timer_pool_stats
+{
+	size_t slabs;       // 已申请的slab个数
+	size_t capacity;    // 节点总数
+	size_t in_use;      // 正在使用的节点数
+	size_t peak;        // 使用量峰值
+	size_t allocs;      // 累计分配次数
+	size_t frees;       // 累计回收次数
+};
+
+template<typename T, int SLAB_NODES = 512>
+class timer_pool
+{
+public:
+	timer_pool(): free_list(NULL), slab_list(NULL)
+	{
+		stats.slabs = stats.capacity = stats.in_use = 0;
+		stats.peak = stats.allocs = stats.frees = 0;
+	}
+	~timer_pool()
+	{
+		/* 还有节点没有归还时不释放slab，避免悬空指针（线程退出时可能发生） */
+		if (stats.in_use) return;
+		while (slab_list)
+		{
+			slab* next = slab_list->next;
+			free(slab_list);
+			slab_list = next;
+		}
+	}
+
+	/* 当前线程的池 */
+	static timer_pool& local()
+	{
+		static thread_local timer_pool pool;
+		return pool;
+	}
+
+	/* 从当前线程的池中分配并构造一个节点 */
+	template<typename... Args>
+	static T* create(Args&&... args)
+	{
+		void* p = local().alloc();
+		return new (p) T(std::forward<Args>(args)...);
+	}
+
+	/* 析构节点并归还到当前线程的池 */
+	static void destroy(T* p)
+	{
+		if (!p) return;
+		p->~T();
+		local().dealloc(p);
+	}
+
+	void* alloc()
+	{
+		if (!free_list) grow();
+		pool_node* node = free_list;
+		free_list = node->next;
+		++stats.allocs;
+		if (++stats.in_use > stats.peak) stats.peak = stats.in_use;
+		return node->storage;
+	}
+
+	void dealloc(void* p)
+	{
+		pool_node* node = reinterpret_cast<pool_node*>(p);
+		node->next = free_list;
+		free_list = node;
+		++stats.frees;
+		--stats.in_use;
+	}
+
+	/* 预先准备至少n个空闲节点，把malloc挪出处理连接的路径 */
+	void reserve(size_t n)
+	{
+		while (stats.capacity - stats.in_use < n) grow();
+	}
+
+	const timer_pool_stats& get_stats() const { return stats; }
+
+	void dump(FILE* fp, const char* name) const
+	{
+		fprintf(fp, "%s pool: node %zu bytes, slabs %zu, capacity %zu, in use %zu, peak %zu, allocs %zu, frees %zu\n",
+			name, sizeof(pool_node), stats.slabs, stats.capacity, stats.in_use, stats.peak, stats.allocs, stats.frees);
+	}
+
+private:
+	union pool_node
+	{
+		pool_node* next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	struct slab
+	{
+		slab* next;
+		pool_node nodes[SLAB_NODES];
+	};
+
+	/* 申请一个新的slab并把其中的节点全部挂到空闲链表上 */
+	void grow()
+	{
+		slab* s = static_cast<slab*>(malloc(sizeof(slab)));
+		if (!s) throw std::bad_alloc();
+		s->next = slab_list;
+		slab_list = s;
+		for (int i = SLAB_NODES - 1; i >= 0; --i)
+		{
+			s->nodes[i].next = free_list;
+			free_list = &s->nodes[i];
+		}
+		++stats.slabs;
+		stats.capacity += SLAB_NODES;
+	}
+
+private:
+	pool_node* free_list;  // 空闲节点链表
+	slab* slab_list;       // 已申请的slab链表
+	timer_pool_stats stats;
+};
+
+#endif
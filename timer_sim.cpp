@@ -0,0 +1,288 @@
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include "lst_timer.h"
+#include "heap_timer.h"
+#include "time_wheel.h"
+#include "hier_time_wheel.h"
+#include "timer_clock.h"
+
+/**
+ * 定时器快进模拟
+ * 用法: timer_sim [trace_file|-] [heap|wheel|hier|list|all]
+ * 把记录下来的连接生命周期按虚拟时钟全速回放给定时器容器：
+ * 连接建立时添加空闲超时定时器，连接正常结束时删除定时器，
+ * 生命周期超过超时时间的连接由定时器关闭
+ * 统计到期数量、回放吞吐（每秒真实时间处理的到期数）以及到期的迟到时间
+ * （实际触发的虚拟时刻 - 应当到期的时刻）
+ *
+ * trace文件每行一个连接：开始时刻(ms) 持续时间(ms) 空闲超时(ms)，#开头为注释
+ * 不指定文件（或者为-）时生成一份合成的记录：20万个连接，约2小时
+ */
+
+struct conn_record
+{
+	uint64_t start;
+	uint64_t duration;
+	uint64_t timeout;
+};
+
+static std::vector<conn_record> records;
+static std::vector<client_data> users;    // sockfd保存连接编号
+static std::vector<char> fired;           // 连接是否被定时器关闭
+static std::vector<uint64_t> lateness;    // 每次到期的迟到时间（ms）
+static virtual_clock vclock;
+
+void sim_cb(client_data* user_data)
+{
+	int id = user_data->sockfd;
+	const conn_record& r = records[id];
+	fired[id] = 1;
+	lateness.push_back(vclock.now_ms() - (r.start + r.timeout));
+}
+
+static uint64_t rand_state = 88172645463325252ULL;
+static double uniform()
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return (rand_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* 指数分布的到达间隔，短连接和长连接混合 */
+static void generate_records(size_t n)
+{
+	uint64_t t = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		conn_record r;
+		t += (uint64_t)(-log(1.0 - uniform()) * 36.0); // 平均每36ms一个新连接
+		r.start = t;
+		double mean = uniform() < 0.7 ? 2000.0 : 120000.0;
+		r.duration = (uint64_t)(-log(1.0 - uniform()) * mean);
+		r.timeout = uniform() < 0.5 ? 30000 : 60000;
+		records.push_back(r);
+	}
+}
+
+static bool load_records(const char* path)
+{
+	FILE* fp = fopen(path, "r");
+	if (!fp) return false;
+	char line[256];
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (line[0] == '#') continue;
+		unsigned long long start, duration, timeout;
+		if (sscanf(line, "%llu %llu %llu", &start, &duration, &timeout) != 3) continue;
+		conn_record r = {start, duration, timeout};
+		records.push_back(r);
+	}
+	fclose(fp);
+	return true;
+}
+
+static bool start_before(const conn_record& a, const conn_record& b)
+{
+	return a.start < b.start;
+}
+
+/**
+ * 适配器：统一为 add(id, timeout_ms) / del / tick 接口
+ * 秒级容器的超时向上取整到秒
+ */
+struct heap_adapter
+{
+	typedef util_timer node;
+	static const char* name() { return "time_heap"; }
+	static const int TICK_MS = 1000;
+	time_heap c;
+	heap_adapter(): c(64, &vclock) {}
+	node* add(client_data* data, uint64_t timeout)
+	{
+		node* timer = timer_pool<util_timer>::create();
+		timer->expire = (vclock.now_ms() + timeout + 999) / 1000;
+		timer->cb_func = sim_cb;
+		timer->user_data = data;
+		c.add_timer(timer);
+		return timer;
+	}
+	void del(node* timer) { c.del_timer(timer); }
+	void tick() { c.tick(); }
+};
+
+struct list_adapter
+{
+	typedef util_timer node;
+	static const char* name() { return "sort_timer_lst"; }
+	static const int TICK_MS = 1000;
+	sort_timer_lst c;
+	list_adapter(): c(&vclock) {}
+	node* add(client_data* data, uint64_t timeout)
+	{
+		node* timer = timer_pool<util_timer>::create();
+		timer->expire = (vclock.now_ms() + timeout + 999) / 1000;
+		timer->cb_func = sim_cb;
+		timer->user_data = data;
+		c.add_timer(timer);
+		return timer;
+	}
+	void del(node* timer) { c.del_timer(timer); }
+	void tick() { c.tick(); }
+};
+
+struct wheel_adapter
+{
+	typedef tw_timer node;
+	static const char* name() { return "time_wheel"; }
+	static const int TICK_MS = 1000;
+	time_wheel c;
+	wheel_adapter(): c(&vclock) {}
+	node* add(client_data* data, uint64_t timeout)
+	{
+		node* timer = c.add_timer((timeout + 999) / 1000);
+		timer->cb_func = sim_cb;
+		timer->user_data = data;
+		return timer;
+	}
+	void del(node* timer) { c.del_timer(timer); }
+	void tick() { c.update(); }
+};
+
+struct hier_adapter
+{
+	typedef hw_timer node;
+	static const char* name() { return "hier_time_wheel"; }
+	static const int TICK_MS = 1;
+	hier_time_wheel c;
+	hier_adapter(): c(&vclock) {}
+	node* add(client_data* data, uint64_t timeout)
+	{
+		node* timer = c.add_timer(timeout);
+		timer->cb_func = sim_cb;
+		timer->user_data = data;
+		return timer;
+	}
+	void del(node* timer) { c.del_timer(timer); }
+	void tick() { c.tick(); }
+};
+
+struct close_event
+{
+	uint64_t when;
+	int id;
+	bool operator<(const close_event& other) const { return when > other.when; } // 最小堆
+};
+
+static uint64_t wall_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+template<typename A>
+void simulate()
+{
+	size_t n = records.size();
+	uint64_t t0 = records.empty() ? 0 : records[0].start;
+	vclock.reset(t0);
+	A* a = new A;
+	std::vector<typename A::node*> timers(n, (typename A::node*)NULL);
+	fired.assign(n, 0);
+	lateness.clear();
+	std::priority_queue<close_event> closes;
+	size_t next_open = 0;
+	uint64_t next_tick = (vclock.now_ms() / A::TICK_MS + 1) * A::TICK_MS;
+	uint64_t start = wall_ns();
+
+	while (next_open < n || !closes.empty())
+	{
+		/* 处理下一次tick之前的建立和结束事件 */
+		while (true)
+		{
+			bool has_open = next_open < n && records[next_open].start < next_tick;
+			bool has_close = !closes.empty() && closes.top().when < next_tick;
+			if (!has_open && !has_close) break;
+			if (has_open && (!has_close || records[next_open].start <= closes.top().when))
+			{
+				const conn_record& r = records[next_open];
+				vclock.set(r.start);
+				timers[next_open] = a->add(&users[next_open], r.timeout);
+				close_event e = {r.start + r.duration, (int)next_open};
+				closes.push(e);
+				++next_open;
+			}
+			else
+			{
+				close_event e = closes.top();
+				closes.pop();
+				vclock.set(e.when);
+				/* 已经被定时器关闭的连接，定时器节点已经回收 */
+				if (!fired[e.id]) a->del(timers[e.id]);
+				timers[e.id] = NULL;
+			}
+		}
+		vclock.set(next_tick);
+		a->tick();
+		next_tick += A::TICK_MS;
+	}
+	uint64_t wall = wall_ns() - start;
+	uint64_t span = vclock.now_ms() - t0;
+	const timer_stats stats = a->c.get_stats();
+	delete a;
+
+	std::sort(lateness.begin(), lateness.end());
+	size_t expired = lateness.size();
+	double sec = wall / 1e9;
+	printf("%-16s conns %zu expired %zu simulated %.1f s in %.3f s (x%.0f), %.0f expiries/s",
+		A::name(), n, expired, span / 1000.0, sec, sec > 0 ? span / 1000.0 / sec : 0.0,
+		sec > 0 ? expired / sec : 0.0);
+	if (expired)
+	{
+		printf(", lateness p50 %llu ms p99 %llu ms max %llu ms",
+			(unsigned long long)lateness[expired / 2],
+			(unsigned long long)lateness[(size_t)(0.99 * (expired - 1))],
+			(unsigned long long)lateness.back());
+	}
+	printf("\n");
+	stats.dump(stdout, A::name());
+}
+
+int main(int argc, char const *argv[])
+{
+	const char* path = argc > 1 ? argv[1] : "-";
+	const char* which = argc > 2 ? argv[2] : "all";
+	if (strcmp(path, "-") == 0)
+	{
+		generate_records(200000);
+	}
+	else if (!load_records(path))
+	{
+		printf("can not open trace file %s\n", path);
+		return 1;
+	}
+	std::sort(records.begin(), records.end(), start_before);
+	users.resize(records.size());
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		users[i].sockfd = (int)i;
+	}
+
+	bool all = strcmp(which, "all") == 0;
+	if (all || strcmp(which, "heap") == 0) simulate<heap_adapter>();
+	if (all || strcmp(which, "wheel") == 0) simulate<wheel_adapter>();
+	if (all || strcmp(which, "hier") == 0) simulate<hier_adapter>();
+	/* sort_timer_lst的添加是O(n)的，只在明确指定时运行 */
+	if (strcmp(which, "list") == 0) simulate<list_adapter>();
+	return 0;
+}
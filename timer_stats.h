@@ -0,0 +1,116 @@
+#ifndef TIMER_STATS
+#define TIMER_STATS
+
+#include <time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * 定时器容器的运行统计
+ * 直方图按2的幂分桶，记录一次只需要一次位运算和几次加法
+ *   lateness          实际触发时刻 - 应当到期时刻（毫秒）
+ *   expired_per_tick  每次tick到期的定时器个数
+ *   callback_ns       每个回调函数的执行时间（纳秒）
+ */
+
+struct log2_histogram
+{
+	uint64_t buckets[65]; // buckets[0]记录0，buckets[i]记录[2^(i-1), 2^i)
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+
+	log2_histogram() { reset(); }
+
+	void reset()
+	{
+		memset(buckets, 0, sizeof(buckets));
+		count = sum = max = 0;
+	}
+
+	void record(uint64_t v)
+	{
+		++buckets[v ? 64 - __builtin_clzll(v) : 0];
+		++count;
+		sum += v;
+		if (v > max) max = v;
+	}
+
+	/* 分位数的近似值（所在桶的上界），p取0~1 */
+	uint64_t percentile(double p) const
+	{
+		if (!count) return 0;
+		uint64_t rank = (uint64_t)(p * count);
+		if (rank >= count) rank = count - 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < 65; ++i)
+		{
+			seen += buckets[i];
+			if (seen > rank)
+			{
+				if (i == 0) return 0;
+				uint64_t upper = i == 64 ? ~0ULL : (1ULL << i) - 1;
+				return upper < max ? upper : max;
+			}
+		}
+		return max;
+	}
+
+	void dump(FILE* fp, const char* name, const char* unit) const
+	{
+		fprintf(fp, "  %-18s count %llu avg %.1f p50 <=%llu p99 <=%llu p99.9 <=%llu max %llu %s\n", name,
+			(unsigned long long)count, count ? (double)sum / count : 0.0,
+			(unsigned long long)percentile(0.5), (unsigned long long)percentile(0.99),
+			(unsigned long long)percentile(0.999), (unsigned long long)max, unit);
+	}
+};
+
+struct timer_stats
+{
+	uint64_t added;    // 累计添加
+	uint64_t deleted;  // 累计删除（未到期被取消）
+	uint64_t expired;  // 累计到期并执行回调
+	uint64_t ticks;    // tick次数
+	int64_t live;      // 当前存活的定时器个数
+	log2_histogram lateness;
+	log2_histogram expired_per_tick;
+	log2_histogram callback_ns;
+
+	timer_stats(): added(0), deleted(0), expired(0), ticks(0), live(0) {}
+
+	void on_add() { ++added; ++live; }
+	void on_del() { ++deleted; --live; }
+	void on_expire(uint64_t late_ms, uint64_t cb_ns)
+	{
+		++expired;
+		--live;
+		lateness.record(late_ms);
+		callback_ns.record(cb_ns);
+	}
+	void on_tick(uint64_t n)
+	{
+		++ticks;
+		expired_per_tick.record(n);
+	}
+
+	/* 用于测量回调执行时间 */
+	static uint64_t now_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	void dump(FILE* fp, const char* name) const
+	{
+		fprintf(fp, "%s: live %lld added %llu deleted %llu expired %llu ticks %llu\n", name, (long long)live,
+			(unsigned long long)added, (unsigned long long)deleted,
+			(unsigned long long)expired, (unsigned long long)ticks);
+		lateness.dump(fp, "lateness", "ms");
+		expired_per_tick.dump(fp, "expired/tick", "timers");
+		callback_ns.dump(fp, "callback", "ns");
+	}
+};
+
+#endif
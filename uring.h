@@ -0,0 +1,225 @@
+#ifndef URING
+#define URING
+
+/**
+ * io_uring的最小封装，直接使用系统调用，不依赖liburing
+ * 编译时检测：有<linux/io_uring.h>时HAVE_IO_URING为1，定义NO_IO_URING可以强制关闭；
+ * 运行时内核不支持（或者被禁止）时init()返回false，调用者退回到原来的同步路径
+ *
+ * 用法：get_sqe()取得提交项并用prep_*填写，一轮事件循环结束时submit()一次提交全部；
+ * 完成时内核写eventfd，把event_fd()注册到epoll中，可读时用peek()/advance()取出完成项
+ */
+
+#if defined(NO_IO_URING) || !defined(__linux__) || !__has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 0
+#else
+#define HAVE_IO_URING 1
+#endif
+
+#if HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+class uring
+{
+public:
+	uring(): ringfd(-1), evfd(-1), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sqes((io_uring_sqe*)MAP_FAILED),
+		sqe_head(0), sqe_tail(0) {}
+	~uring()
+	{
+		if (sqes != MAP_FAILED) munmap(sqes, sq_entries * sizeof(io_uring_sqe));
+		if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+		if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+		if (evfd >= 0) close(evfd);
+		if (ringfd >= 0) close(ringfd);
+	}
+
+	/* 建立entries项的提交队列（完成队列是它的两倍）和通知用的eventfd，失败时返回false */
+	bool init(unsigned entries)
+	{
+		struct io_uring_params p;
+		memset(&p, '\0', sizeof(p));
+		ringfd = syscall(__NR_io_uring_setup, entries, &p);
+		if (ringfd < 0) return false;
+		sq_entries = p.sq_entries;
+		sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			if (cq_size > sq_size) sq_size = cq_size;
+			cq_size = sq_size;
+		}
+		sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+		if (sq_ptr == MAP_FAILED) return false;
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			cq_ptr = sq_ptr;
+		}
+		else
+		{
+			cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+			if (cq_ptr == MAP_FAILED) return false;
+		}
+		sqes = (io_uring_sqe*)mmap(NULL, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) return false;
+
+		char* sq = (char*)sq_ptr;
+		sq_head = (unsigned*)(sq + p.sq_off.head);
+		sq_tail = (unsigned*)(sq + p.sq_off.tail);
+		sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+		sq_array = (unsigned*)(sq + p.sq_off.array);
+		char* cq = (char*)cq_ptr;
+		cq_head = (unsigned*)(cq + p.cq_off.head);
+		cq_tail = (unsigned*)(cq + p.cq_off.tail);
+		cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+		sqe_head = sqe_tail = *sq_tail;
+
+		evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (evfd < 0) return false;
+		if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_EVENTFD, &evfd, 1) < 0) return false;
+		return true;
+	}
+
+	/* 有完成项时可读，读出计数后用peek()取完成项 */
+	int event_fd() const { return evfd; }
+
+	/* 取一个空的提交项，提交队列满时先把已有的提交给内核 */
+	io_uring_sqe* get_sqe()
+	{
+		if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+		{
+			submit();
+			if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) return NULL;
+		}
+		io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+		++sqe_tail;
+		memset(sqe, '\0', sizeof(*sqe));
+		return sqe;
+	}
+
+	/**
+	 * 一次系统调用提交所有填好的提交项（包括之前没有被内核取走的），返回提交的个数
+	 * 失败时返回-1和errno：EAGAIN、EBUSY是暂时的，提交项留在队列中，下一次submit()重试；
+	 * 其他错误时可以用unsubmit()取回这些提交项
+	 */
+	int submit()
+	{
+		unsigned tail = *sq_tail;
+		while (sqe_head != sqe_tail)
+		{
+			sq_array[tail & sq_mask] = sqe_head & sq_mask;
+			++tail;
+			++sqe_head;
+		}
+		__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+		unsigned count = unsubmitted();
+		if (count == 0) return 0;
+		int ret;
+		do
+		{
+			ret = syscall(__NR_io_uring_enter, ringfd, count, 0, 0, NULL, 0);
+		} while (ret < 0 && errno == EINTR);
+		return ret;
+	}
+
+	/* 已经交给内核但还没有被取走的提交项个数 */
+	unsigned unsubmitted() const
+	{
+		return *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	}
+
+	/**
+	 * 在submit()之后调用，取回最后一个没有被内核取走的提交项，返回false表示没有了
+	 * user_data是提交项的user_data，调用者据此结束对应的操作
+	 */
+	bool unsubmit(uint64_t& user_data)
+	{
+		if (sqe_head != sqe_tail || unsubmitted() == 0) return false;
+		unsigned tail = *sq_tail - 1;
+		user_data = sqes[sq_array[tail & sq_mask]].user_data;
+		__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+		/* 提交项与队列位置一一对应，一起退回 */
+		--sqe_head;
+		--sqe_tail;
+		return true;
+	}
+
+	/* 取出下一个完成项，没有时返回NULL；处理完后调用advance() */
+	io_uring_cqe* peek()
+	{
+		unsigned head = *cq_head;
+		if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+		return &cqes[head & cq_mask];
+	}
+
+	void advance()
+	{
+		__atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+	}
+
+	static void prep_read(io_uring_sqe* sqe, int fd, void* buf, unsigned len, off_t offset, uint64_t user_data)
+	{
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)buf;
+		sqe->len = len;
+		sqe->off = offset;
+		sqe->user_data = user_data;
+	}
+
+	static void prep_send(io_uring_sqe* sqe, int fd, const void* buf, unsigned len, int flags, uint64_t user_data)
+	{
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)buf;
+		sqe->len = len;
+		sqe->msg_flags = flags;
+		sqe->user_data = user_data;
+	}
+
+	/* 单次的poll，事件发生时完成，res为发生的事件 */
+	static void prep_poll(io_uring_sqe* sqe, int fd, unsigned events, uint64_t user_data)
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = events;
+		sqe->user_data = user_data;
+	}
+
+private:
+	uring(const uring&);
+	uring& operator=(const uring&);
+
+	int ringfd;
+	int evfd;
+	void* sq_ptr;
+	void* cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	io_uring_sqe* sqes;
+	unsigned sq_entries;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	io_uring_cqe* cqes;
+	unsigned sqe_head; // 已经填好但还没有交给内核的提交项是[sqe_head, sqe_tail)
+	unsigned sqe_tail;
+};
+
+#endif
+
+#endif